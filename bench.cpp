@@ -0,0 +1,342 @@
+/**
+ * @file bench.cpp
+ * @brief Measures how fast frames are committed
+ *
+ * The screen is drawn to a temporary file rather than to the terminal, so
+ * that the bytes curses emits can be counted, and the allocations made
+ * through operator new are counted too. Allocations made by curses itself
+ * are not. The frame rate counts both the changes and the commit of each
+ * frame, while the latencies only count the commit. Each scenario runs
+ * without and with compositing:
+ *
+ * @code
+ * make bench
+ * ./benchmark 5000
+ * @endcode
+ */
+#include "simplecurses++.hh"
+
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace SimpleCurses;
+
+static std::atomic<size_t> allocations{0};
+
+/**
+ * @brief Counts an allocation and makes it with malloc
+ *
+ * Every replaced operator new goes through here, and every operator delete
+ * through release(), so that the allocations stay paired with free.
+ */
+static void *allocate(size_t size, size_t alignment = 0) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  size = size ? size : 1;
+  if (alignment > alignof(std::max_align_t)) {
+    size = (size + alignment - 1) & ~(alignment - 1);
+    return std::aligned_alloc(alignment, size);
+  }
+  return std::malloc(size);
+}
+
+/**
+ * @brief Frees memory returned by allocate()
+ *
+ * Kept out of line, so the compiler doesn't see free() paired with new.
+ */
+__attribute__((noinline)) static void release(void *memory) noexcept {
+  std::free(memory);
+}
+
+static void *allocateOrThrow(size_t size, size_t alignment = 0) {
+  void *memory = allocate(size, alignment);
+  if (!memory) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void *operator new(size_t size) { return allocateOrThrow(size); }
+
+void *operator new[](size_t size) { return allocateOrThrow(size); }
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return allocate(size);
+}
+
+void operator delete(void *memory) noexcept { release(memory); }
+
+void operator delete[](void *memory) noexcept { release(memory); }
+
+void operator delete(void *memory, size_t) noexcept { release(memory); }
+
+void operator delete[](void *memory, size_t) noexcept { release(memory); }
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+  release(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+  release(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+  release(memory);
+}
+
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+  release(memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t &) noexcept {
+  release(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t &) noexcept {
+  release(memory);
+}
+
+/**
+ * @brief A workload, built in a window covering the screen
+ */
+class Scenario {
+public:
+  virtual ~Scenario() = default;
+
+  /** @brief The name of the scenario **/
+  virtual const char *name() const = 0;
+
+  /**
+   * @brief Builds the elements of the scenario
+   *
+   * @param root The window covering the screen.
+   */
+  virtual void setup(Window &root) = 0;
+
+  /**
+   * @brief Changes the elements for a frame
+   *
+   * @param root The window covering the screen.
+   * @param frame The number of the frame.
+   */
+  virtual void frame(Window &root, unsigned frame) = 0;
+};
+
+/**
+ * @brief A grid of small fields, all updated every frame
+ */
+class TextUpdates : public Scenario {
+public:
+  const char *name() const { return "text"; }
+
+  void setup(Window &root) {
+    m_fields.clear();
+    for (int row = 0; row < root.rows(); row++) {
+      for (int col = 0; col + 10 <= root.cols(); col += 10) {
+        std::string name = std::to_string(row) + "." + std::to_string(col);
+        m_fields.push_back(&root.emplace<Text>(name, col, row, "0"));
+      }
+    }
+  }
+
+  void frame(Window &, unsigned frame) {
+    for (size_t i = 0; i < m_fields.size(); i++) {
+      m_fields[i]->format("%9u", frame * 7 + static_cast<unsigned>(i));
+    }
+  }
+
+private:
+  std::vector<Text *> m_fields;
+};
+
+/**
+ * @brief Windows nested as deep as the screen allows, with a field
+ * updated in the innermost one
+ */
+class Nesting : public Scenario {
+public:
+  const char *name() const { return "nesting"; }
+
+  void setup(Window &root) {
+    Window *window = &root;
+    while (window->rows() > 6 && window->cols() > 16) {
+      window = &window->emplace<Window>("child", 2, 1, window->rows() - 2,
+                                        window->cols() - 4, true);
+    }
+    m_field = &window->emplace<Text>("field", 1, 1, "0");
+  }
+
+  void frame(Window &, unsigned frame) { m_field->format("%9u", frame); }
+
+private:
+  Text *m_field = NULL;
+};
+
+/**
+ * @brief Fields added and removed again every frame
+ */
+class Churn : public Scenario {
+public:
+  const char *name() const { return "churn"; }
+
+  void setup(Window &) {}
+
+  void frame(Window &root, unsigned frame) {
+    int count = root.rows() * 4;
+    m_ids.clear();
+    for (int i = 0; i < count; i++) {
+      std::unique_ptr<Text> field =
+          std::make_unique<Text>((i % 4) * 12, i / 4, "field");
+      m_ids.push_back(root.add(std::move(field)));
+    }
+    for (ElementId id : m_ids) {
+      root.remove(id);
+    }
+    (void)frame;
+  }
+
+private:
+  std::vector<ElementId> m_ids;
+};
+
+/**
+ * @brief Every row of the screen rewritten every frame
+ *
+ * The rows don't just shift, which curses would turn into scrolling.
+ */
+class Repaint : public Scenario {
+public:
+  const char *name() const { return "repaint"; }
+
+  void setup(Window &root) {
+    m_rows.clear();
+    m_line.assign(root.cols(), ' ');
+    for (int row = 0; row < root.rows(); row++) {
+      m_rows.push_back(
+          &root.emplace<Text>(std::to_string(row), 0, row, m_line));
+    }
+  }
+
+  void frame(Window &, unsigned frame) {
+    for (size_t row = 0; row < m_rows.size(); row++) {
+      for (size_t col = 0; col < m_line.size(); col++) {
+        m_line[col] = 'a' + ((row * 31 + col * 17) ^ frame) % 26;
+      }
+      m_rows[row]->setText(m_line);
+    }
+  }
+
+private:
+  std::vector<Text *> m_rows;
+  std::string m_line;
+};
+
+/**
+ * @brief The number of bytes written to the screen so far
+ */
+static long long written() {
+  fflush(stdout);
+  struct stat status;
+  return fstat(STDOUT_FILENO, &status) == 0 ? status.st_size : 0;
+}
+
+/**
+ * @brief Runs a scenario and reports its measures
+ */
+static void run(Screen &screen, Scenario &scenario, bool compositing,
+                unsigned frames, FILE *report) {
+  screen.setCompositing(compositing);
+  Window &root = screen.emplace<Window>("bench", 0, 0, screen.rows(),
+                                        screen.cols(), false);
+  scenario.setup(root);
+  screen.commit();
+
+  std::vector<double> latencies;
+  latencies.reserve(frames);
+  long long bytes = written();
+  size_t allocated = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < frames; i++) {
+    scenario.frame(root, i + 1);
+    auto before = std::chrono::steady_clock::now();
+    screen.commit();
+    auto after = std::chrono::steady_clock::now();
+    latencies.push_back(
+        std::chrono::duration<double, std::micro>(after - before).count());
+  }
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+  allocated = allocations.load() - allocated;
+  bytes = written() - bytes;
+
+  screen.remove("bench");
+  screen.commit();
+
+  std::sort(latencies.begin(), latencies.end());
+  fprintf(report, "%-10s %-10s %10.1f %10.1f %10.1f %12.1f %12.2f\n",
+          scenario.name(), compositing ? "composite" : "direct",
+          frames / seconds, latencies[latencies.size() / 2],
+          latencies[latencies.size() * 99 / 100],
+          static_cast<double>(bytes) / frames,
+          static_cast<double>(allocated) / frames);
+}
+
+int main(int argc, char **argv) {
+  unsigned frames = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000;
+  if (frames == 0) {
+    fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+    return 1;
+  }
+
+  // Curses draws to a temporary file, and the report goes to stdout.
+  FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+  FILE *output = tmpfile();
+  if (!report || !output) {
+    perror("bench");
+    return 1;
+  }
+  dup2(fileno(output), STDOUT_FILENO);
+  setenv("TERM", "xterm-256color", 0);
+  setenv("LINES", "50", 0);
+  setenv("COLUMNS", "200", 0);
+
+  try {
+    Screen screen;
+    TextUpdates text;
+    Nesting nesting;
+    Churn churn;
+    Repaint repaint;
+    Scenario *scenarios[] = {&text, &nesting, &churn, &repaint};
+
+    fprintf(report, "%-10s %-10s %10s %10s %10s %12s %12s\n", "scenario",
+            "mode", "frames/s", "p50 us", "p99 us", "bytes/frame",
+            "allocs/frame");
+    for (Scenario *scenario : scenarios) {
+      for (bool compositing : {false, true}) {
+        run(screen, *scenario, compositing, frames, report);
+      }
+    }
+  } catch (const CursesException &ex) {
+    fprintf(report, "%s\n", ex.what());
+    return 1;
+  }
+  fclose(report);
+  return 0;
+}
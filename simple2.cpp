@@ -11,14 +11,10 @@ int main() {
     Window &subchild =
         child.add("test2", std::make_unique<Window>(4, 4, 10, 10, true));
     subchild.add("field", std::make_unique<Text>(0, 0, "sub"));
-    subchild.update();
-    child.update();
-    screen.update();
+    screen.commit();
     getchar();
     subchild.remove("field");
-    subchild.update();
-    child.update();
-    screen.update();
+    screen.commit();
     getchar();
   } catch (const CursesException &ex) {
     std::cerr << ex.what() << std::endl;
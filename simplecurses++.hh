@@ -8,17 +8,53 @@
  * @code
  * #include <simplecurses++.hh>
  * @endcode
+ *
+ * Defining SIMPLECURSES_WIDECHAR before including it draws non-ASCII text
+ * with the wide-character API, which requires linking with ncursesw.
+ * Defining SIMPLECURSES_STATS makes Screen count what every frame costs
+ * and trace the time spent drawing; otherwise none of it is compiled in.
  */
 #ifndef SIMPLECURSESPP_HH
 #define SIMPLECURSESPP_HH
 
 #include <curses.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <chrono>
+#include <csignal>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <deque>
+#include <functional>
 #include <iostream>
-#include <map>
+#include <list>
 #include <memory>
+#include <new>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 /**
  * @example example.cpp
@@ -44,6 +80,410 @@ private:
   std::string m_message;
 };
 
+class Element;
+class Window;
+
+/**
+ * @brief A handle to an element in a window
+ *
+ * Handles are only meaningful to the window that returned them, and are
+ * reused once the element is removed.
+ */
+typedef std::size_t ElementId;
+
+/**
+ * @brief A rectangular region, relative to a container
+ */
+struct Rect {
+  /** @brief The x coordinate **/
+  int x;
+
+  /** @brief The y coordinate **/
+  int y;
+
+  /** @brief The number of rows **/
+  int rows;
+
+  /** @brief The number of cols **/
+  int cols;
+
+  bool operator==(const Rect &other) const {
+    return x == other.x && y == other.y && rows == other.rows &&
+           cols == other.cols;
+  }
+
+  /** @brief Whether the two regions share any cell **/
+  bool intersects(const Rect &other) const {
+    return x < other.x + other.cols && other.x < x + cols &&
+           y < other.y + other.rows && other.y < y + rows;
+  }
+
+  bool operator!=(const Rect &other) const { return !(*this == other); }
+};
+
+/**
+ * @brief The colors and attributes of drawn cells
+ */
+struct Style {
+  /** @brief The foreground color, or -1 for the default **/
+  short fg = -1;
+
+  /** @brief The background color, or -1 for the default **/
+  short bg = -1;
+
+  /** @brief The attributes, like A_BOLD, without any color **/
+  attr_t attrs = A_NORMAL;
+
+  bool operator==(const Style &other) const {
+    return fg == other.fg && bg == other.bg && attrs == other.attrs;
+  }
+
+  bool operator!=(const Style &other) const { return !(*this == other); }
+};
+
+/**
+ * @brief A cache of the color pairs of a screen
+ *
+ * Color pairs are allocated on first use of a combination of colors, and
+ * the least recently used pair is reused once all the pairs of the terminal
+ * are taken. Cells still drawn with a reused pair change colors.
+ */
+class ColorPairs {
+public:
+  /**
+   * @brief Gets the color pair of a combination of colors
+   *
+   * Pairs are numbered as shorts, so at most SHRT_MAX of them are used,
+   * whatever COLOR_PAIRS is.
+   *
+   * @param fg The foreground color, or -1 for the default.
+   * @param bg The background color, or -1 for the default.
+   * @return The color pair, or 0 if the terminal has no colors.
+   */
+  short get(short fg, short bg) {
+    if ((fg == -1 && bg == -1) || !start()) {
+      return 0;
+    }
+    uint32_t key = (static_cast<uint32_t>(static_cast<uint16_t>(fg)) << 16) |
+                   static_cast<uint16_t>(bg);
+    auto found = m_pairs.find(key);
+    if (found != m_pairs.end()) {
+      m_recent.splice(m_recent.begin(), m_recent, found->second.recent);
+      return found->second.pair;
+    }
+
+    short pair;
+    if (m_next < std::min(COLOR_PAIRS, SHRT_MAX + 1)) {
+      pair = static_cast<short>(m_next++);
+    } else if (!m_recent.empty()) {
+      auto evicted = m_pairs.find(m_recent.back());
+      pair = evicted->second.pair;
+      m_pairs.erase(evicted);
+      m_recent.pop_back();
+    } else {
+      return 0;
+    }
+    init_pair(pair, fg, bg);
+    m_recent.push_front(key);
+    m_pairs[key] = Entry{pair, m_recent.begin()};
+    return pair;
+  }
+
+private:
+  /**
+   * @brief Starts the colors on first use
+   *
+   * @return Whether the terminal has colors.
+   */
+  bool start() {
+    if (!m_started) {
+      m_started = true;
+      m_colors = has_colors() && start_color() == OK;
+      if (m_colors) {
+        use_default_colors();
+      }
+    }
+    return m_colors;
+  }
+
+  struct Entry {
+    short pair;
+    std::list<uint32_t>::iterator recent;
+  };
+
+  bool m_started = false;
+
+  bool m_colors = false;
+
+  /** @brief The next pair never allocated, pair 0 being reserved **/
+  int m_next = 1;
+
+  /** @brief The pairs, by combination of colors **/
+  std::unordered_map<uint32_t, Entry> m_pairs;
+
+  /** @brief The combinations of colors, most recently used first **/
+  std::list<uint32_t> m_recent;
+};
+
+/**
+ * @brief Sets the attributes of a window, unless they are already set
+ *
+ * This avoids emitting redundant attribute changes between spans drawn
+ * with the same style.
+ */
+inline void applyAttributes(WINDOW *window, attr_t attrs, short pair) {
+  attr_t current;
+  short currentPair;
+  if (wattr_get(window, &current, &currentPair, NULL) == OK &&
+      current == attrs && currentPair == pair) {
+    return;
+  }
+  wattr_set(window, attrs, pair, NULL);
+}
+
+/**
+ * @brief Checks whether a text is only made of ASCII characters
+ *
+ * Scans 16 bytes per iteration when SSE2 is available.
+ */
+inline bool isAscii(std::string_view text) {
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(text.data());
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= text.size(); i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    if (_mm_movemask_epi8(bytes)) {
+      return false;
+    }
+  }
+#endif
+  for (; i < text.size(); i++) {
+    if (data[i] & 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Measures the number of cols a text occupies on the terminal
+ *
+ * Non-ASCII text is decoded in the encoding of the current locale, and
+ * measured with wcwidth(). Invalid sequences count as one col per byte.
+ *
+ * @param text The text.
+ * @param ascii Set to whether the text is only made of ASCII characters.
+ */
+inline int displayWidth(std::string_view text, bool &ascii) {
+  ascii = isAscii(text);
+  if (ascii) {
+    return text.size();
+  }
+  int width = 0;
+  std::mbstate_t state = std::mbstate_t();
+  size_t i = 0;
+  while (i < text.size()) {
+    wchar_t wc;
+    size_t length = std::mbrtowc(&wc, text.data() + i, text.size() - i, &state);
+    if (length == static_cast<size_t>(-1) ||
+        length == static_cast<size_t>(-2)) {
+      state = std::mbstate_t();
+      width++;
+      i++;
+      continue;
+    }
+    int cells = wcwidth(wc);
+    width += cells < 0 ? 1 : cells;
+    i += std::max<size_t>(length, 1);
+  }
+  return width;
+}
+
+/**
+ * @brief The glyph of a meter cell filled to some eighths
+ *
+ * With SIMPLECURSES_WIDECHAR defined, the block characters fill cells to
+ * the eighth; otherwise the cells are filled with ASCII, to the quarter.
+ *
+ * @param eighths How full the cell is, from 0 to 8.
+ * @param vertical Whether the cell fills from the bottom, rather than
+ * from the left.
+ */
+#ifdef SIMPLECURSES_WIDECHAR
+inline wchar_t meterGlyph(int eighths, bool vertical) {
+  static const wchar_t horizontal[] = L" \u258F\u258E\u258D\u258C\u258B"
+                                      L"\u258A\u2589\u2588";
+  static const wchar_t rising[] = L" \u2581\u2582\u2583\u2584\u2585\u2586"
+                                  L"\u2587\u2588";
+  return vertical ? rising[eighths] : horizontal[eighths];
+}
+#else
+inline char meterGlyph(int eighths, bool vertical) {
+  (void)vertical;
+  return " ..--==##"[eighths];
+}
+#endif
+
+/**
+ * @brief Writes the glyph of a meter cell with the attributes of a window
+ *
+ * @copydetails meterGlyph()
+ */
+inline void putMeterGlyph(WINDOW *window, int y, int x, int eighths,
+                          bool vertical) {
+#ifdef SIMPLECURSES_WIDECHAR
+  wchar_t glyph = meterGlyph(eighths, vertical);
+  mvwaddnwstr(window, y, x, &glyph, 1);
+#else
+  mvwaddch(window, y, x, meterGlyph(eighths, vertical));
+#endif
+}
+
+/**
+ * @brief How full a meter of some cells is, in eighths of a cell
+ *
+ * @param fraction The fraction of the meter filled, clamped to [0, 1].
+ * @param cells The number of cells of the meter.
+ */
+inline int meterEighths(double fraction, int cells) {
+  if (!(fraction > 0)) {
+    return 0;
+  }
+  return static_cast<int>(std::min(fraction, 1.0) * cells * 8 + 0.5);
+}
+
+/**
+ * @brief What committing a frame cost
+ *
+ * A frame covers everything done since the previous commit. The counters
+ * are only filled in when SIMPLECURSES_STATS is defined.
+ */
+struct FrameStats {
+  /** @brief The number of calls of Element::draw() **/
+  unsigned long elementsDrawn = 0;
+
+  /** @brief The number of cells touched for curses to compare **/
+  unsigned long cellsTouched = 0;
+
+  /** @brief The number of windows copied to the virtual screen **/
+  unsigned long refreshes = 0;
+
+  /** @brief The number of doupdate() calls **/
+  unsigned long updates = 0;
+
+  /** @brief The number of bytes written by doupdate() **/
+  unsigned long long bytesWritten = 0;
+
+  /** @brief The time spent in Element::draw(), nested calls included once **/
+  std::chrono::nanoseconds drawTime{0};
+
+  /** @brief The time spent in Screen::commit() **/
+  std::chrono::nanoseconds commitTime{0};
+
+  FrameStats &operator+=(const FrameStats &other) {
+    elementsDrawn += other.elementsDrawn;
+    cellsTouched += other.cellsTouched;
+    refreshes += other.refreshes;
+    updates += other.updates;
+    bytesWritten += other.bytesWritten;
+    drawTime += other.drawTime;
+    commitTime += other.commitTime;
+    return *this;
+  }
+};
+
+/**
+ * @brief A timed step of rendering, passed to the trace callback of a
+ * screen
+ */
+struct TraceEvent {
+  /** @brief The step, like "draw", "commit" or "doupdate" **/
+  const char *name;
+
+  /** @brief The name of the element drawn, if it has one **/
+  const std::string *element;
+
+  /** @brief The element drawn, if any **/
+  const Element *source;
+
+  std::chrono::steady_clock::time_point start;
+
+  std::chrono::nanoseconds duration;
+};
+
+/**
+ * @brief The counters and trace callback of a screen, shared with its
+ * windows
+ */
+struct Instrumentation {
+  /** @brief The frame being built **/
+  FrameStats frame;
+
+  /** @brief The callback run for every traced step, if any **/
+  std::function<void(const TraceEvent &)> trace;
+
+  /** @brief The depth of the draws in progress **/
+  unsigned depth = 0;
+};
+
+#ifdef SIMPLECURSES_STATS
+/**
+ * @brief A trace callback writing Chrome's trace event format
+ *
+ * The file can be loaded in chrome://tracing or Perfetto. Draws are named
+ * after the elements drawn, when they have a name, and nest within the
+ * draws of their windows.
+ *
+ * @code
+ * screen.onTrace(ChromeTrace(fopen("frames.json", "w")));
+ * @endcode
+ */
+class ChromeTrace {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param file The file to write to, which is left open.
+   */
+  explicit ChromeTrace(FILE *file) : m_file(file) {
+    if (!m_file) {
+      throw CursesException("No trace file provided.");
+    }
+    // The closing bracket is optional in this format.
+    std::fputs("[\n", m_file);
+  }
+
+  void operator()(const TraceEvent &event) const {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    long long start =
+        duration_cast<microseconds>(event.start.time_since_epoch()).count();
+    std::fprintf(m_file, "{\"name\":\"");
+    if (event.element) {
+      for (char c : *event.element) {
+        if (c == '"' || c == '\\') {
+          std::fputc('\\', m_file);
+          std::fputc(c, m_file);
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+          std::fputc(c, m_file);
+        }
+      }
+    } else {
+      std::fputs(event.name, m_file);
+    }
+    std::fprintf(m_file,
+                 "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,"
+                 "\"dur\":%.3f,\"pid\":%d,\"tid\":1},\n",
+                 event.name, start, event.duration.count() / 1000.0,
+                 static_cast<int>(getpid()));
+  }
+
+private:
+  FILE *m_file;
+};
+#endif
+
 /**
  * @brief Represents an element in the interface
  */
@@ -55,7 +495,7 @@ public:
    * @param x The x coordinate relative to its container
    * @param y The y coordinate relative to its container
    */
-  Element(int x, int y) : m_x(x), m_y(y) {}
+  Element(int x, int y) : m_x(x), m_y(y), m_parent(NULL) {}
 
   /**
    * @brief Destructor
@@ -74,174 +514,5961 @@ public:
   /** @brief The number of cols occupied by the element **/
   virtual int cols() const = 0;
 
+  /** @brief The region occupied by the element in its container **/
+  Rect bounds() const { return Rect{x(), y(), rows(), cols()}; }
+
+  /** @brief The window containing the element, if any **/
+  Window *parent() const { return m_parent; }
+
+  /**
+   * @brief Marks the region occupied by the element as changed
+   *
+   * Only the lines marked this way are repainted on the next update.
+   */
+  void invalidate();
+
   /** @brief Draw element onto window.
    *
    * @param The parent window.
    */
   virtual void draw(WINDOW *parent) = 0;
 
-private:
-  /** @brief The x coordinate **/
-  int m_x;
-
-  /** @brief The y coordinate **/
-  int m_y;
-};
-
-class Text : public Element {
-public:
-  Text(int x, int y, const std::string &text) : Element(x, y), m_text(text) {}
-
-  virtual ~Text() = default;
-
+protected:
   /**
-   * @brief Gets the text of the element
+   * @brief Stages the pending changes of the element for the next doupdate()
+   *
+   * Elements that are not backed by their own curses window have nothing to
+   * stage.
+   *
+   * @param refresh Whether to copy the changes to the virtual screen, which
+   * windows sharing their memory with a composited screen don't need.
+   * @return Whether anything was copied to the virtual screen.
    */
-  const std::string &text() const { return m_text; }
+  virtual bool stage(bool refresh) {
+    (void)refresh;
+    return false;
+  }
 
   /**
-   * @copydoc Element::rows()
+   * @brief Catches up with drawing deferred until the next update
+   *
+   * This runs before the damage is staged, and elements deferring their
+   * drawing must have damaged themselves to be reached.
    */
-  int rows() const { return 1; }
+  virtual void prepare() {}
 
   /**
-   * @copydoc Element::cols()
+   * @brief Brings the element in line with its container after the
+   * terminal is resized
    */
-  int cols() const { return m_text.size(); }
-
-  void draw(WINDOW *parent) { mvwaddstr(parent, y(), x(), m_text.c_str()); }
-
-private:
-  std::string m_text;
-};
-
-/**
- * @brief A window in the interface
- */
-class Window : public Element {
-public:
-  Window(int x, int y, int rows, int cols, bool border)
-      : Element(x, y), m_rows(rows), m_cols(cols), m_border(border),
-        m_window(NULL) {
-    if (m_border) {
-      m_rows--;
-      m_cols--;
-    }
-  }
+  virtual void resized() {}
 
   /**
-   * @brief Destructor
+   * @brief Frees the curses resources of the element
+   *
+   * They are recreated by the next draw().
    */
-  virtual ~Window() { delwin(m_window); }
+  virtual void detach() {}
 
   /**
-   * @brief Updates the screen with the changes in the window
+   * @brief Moves the element within its container
+   *
+   * @param x The new x coordinate
+   * @param y The new y coordinate
    */
-  void update() {
-    // std::for_each(m_subwindows.begin(), m_subwindows.end(), [&](WindowPtr&
-    // window) { 		window->update();
-    //});
-    touchwin(m_window);
-    wrefresh(m_window);
+  void setPosition(int x, int y) {
+    m_x = x;
+    m_y = y;
   }
 
   /**
-   * @copydoc Element::rows()
+   * @brief Sets the attributes of a window to draw with a style
+   *
+   * The colors are resolved through the color pairs of the screen showing
+   * the element.
+   *
+   * @param window The window to draw in.
+   * @param style The style.
    */
-  int rows() const { return m_rows; }
+  void applyStyle(WINDOW *window, const Style &style);
 
-  /**
-   * @copydoc Element::cols()
-   */
-  int cols() const { return m_cols; }
+private:
+  friend class Window;
 
-  void draw(WINDOW *parent) {
-    if (!m_window) {
-      m_window = derwin(parent, m_cols, m_rows, y(), x());
-    }
-    if (m_border) {
-      box(m_window, 0, 0);
-    }
-  }
+  /** @brief The x coordinate **/
+  int m_x;
 
-  template <typename WindowElement>
-  WindowElement &add(const std::string &name,
-                     std::unique_ptr<WindowElement> element) {
-    if (!element) {
-      throw CursesException("No element provided.");
-    }
+  /** @brief The y coordinate **/
+  int m_y;
 
-    if ((element->x() + element->cols() > m_cols) ||
-        (element->y() + element->rows() > m_rows)) {
-      throw CursesException("Element doesn't fit in window");
-    }
+  /** @brief The containing window **/
+  Window *m_parent;
 
-    WindowElement &ref = *element.get();
-    ref.draw(m_window);
-    m_elements[name] = std::move(element);
-    return ref;
-  }
+  /** @brief The handle of the element in its containing window **/
+  ElementId m_id = 0;
+};
+
+/**
+ * @brief Pooled storage for the elements owned by a window
+ *
+ * Memory is carved out of large blocks and recycled per size when elements
+ * are removed. It is only returned to the system, all at once, when the
+ * pool is destroyed.
+ */
+class ElementPool {
+public:
+  ElementPool() = default;
+
+  ElementPool(const ElementPool &) = delete;
+
+  ElementPool &operator=(const ElementPool &) = delete;
 
   /**
-   * @brief Remove an element in the window
+   * @brief Allocates storage
    *
-   * @param name The name of the element to remove.
+   * @param size The size of the storage, in bytes.
    */
-  void remove(const std::string &name) {
-    const ElementPtr &element = m_elements.at(name);
-    for (size_t i = element->y(); i < element->rows(); i++) {
-      wmove(this->m_window, i, element->x());
-      for (int j = 0; j < element->cols(); j++) {
-        waddch(this->m_window, ' ');
+  void *allocate(size_t size) {
+    size = align(size);
+    for (auto &list : m_free) {
+      if (list.first == size && list.second) {
+        FreeBlock *block = list.second;
+        list.second = block->next;
+        return block;
       }
     }
-    if (m_border) {
-      if (element->x() == 0 || element->y() == 0 ||
-          (element->x() + element->cols()) == (m_cols - 1) ||
-          (element->y() + element->rows()) == (m_rows - 1)) {
-        draw(NULL); // Parent not necessary, just redrawing border.
-      }
+
+    if (m_blocks.empty() || m_used + size > m_capacity) {
+      m_capacity = std::max(size, BlockSize);
+      m_blocks.emplace_back(new unsigned char[m_capacity]);
+      m_used = 0;
     }
-    m_elements.erase(name);
+    void *memory = m_blocks.back().get() + m_used;
+    m_used += size;
+    return memory;
   }
 
-protected:
   /**
-   * @brief Protected constructor
+   * @brief Recycles storage returned by allocate()
    *
-   * This exists solely to allow Screen to be a special type of Window.
+   * @param memory The storage.
+   * @param size The size the storage was allocated with.
    */
-  Window(int x, int y, WINDOW *window) : Element(x, y), m_window(window) {
-    getmaxyx(window, m_cols, m_rows);
+  void deallocate(void *memory, size_t size) {
+    size = align(size);
+    FreeBlock *block = static_cast<FreeBlock *>(memory);
+    for (auto &list : m_free) {
+      if (list.first == size) {
+        block->next = list.second;
+        list.second = block;
+        return;
+      }
+    }
+    block->next = NULL;
+    m_free.emplace_back(size, block);
   }
 
 private:
-  typedef std::unique_ptr<Window> WindowPtr;
-  typedef std::unique_ptr<Element> ElementPtr;
+  /** @brief The size of the blocks storage is carved out of **/
+  static constexpr size_t BlockSize = 16384;
 
-  WINDOW *m_window;
+  /**
+   * @brief A recycled piece of storage
+   */
+  struct FreeBlock {
+    FreeBlock *next;
+  };
 
-  bool m_border;
+  static size_t align(size_t size) {
+    const size_t alignment = alignof(std::max_align_t);
+    size = std::max(size, sizeof(FreeBlock));
+    return (size + alignment - 1) / alignment * alignment;
+  }
 
-  int m_rows;
+  /** @brief The blocks, the last of which is being carved out **/
+  std::vector<std::unique_ptr<unsigned char[]>> m_blocks;
 
-  int m_cols;
+  /** @brief The bytes carved out of the last block **/
+  size_t m_used = 0;
 
-  std::map<std::string, ElementPtr> m_elements;
+  /** @brief The size of the last block **/
+  size_t m_capacity = 0;
+
+  /** @brief The recycled storage, by size **/
+  std::vector<std::pair<size_t, FreeBlock *>> m_free;
 };
 
 /**
- * @brief Represents a curses screen
+ * @brief Destroys an element, whether it is pooled or not
  */
-class Screen : public Window {
-public:
-  Screen() : Window(0, 0, initscr()) {}
+struct ElementDeleter {
+  ElementDeleter() = default;
 
-  virtual ~Screen() { endwin(); }
-
-  virtual void draw(WINDOW *window) {
+  /**
+   * @brief Constructor for a pooled element
+   *
+   * @param pool The pool the element was allocated from.
+   * @param size The size of the element.
+   */
+  ElementDeleter(ElementPool *pool, size_t size) : pool(pool), size(size) {}
+
+  /**
+   * @brief Conversion from the default deleter of std::unique_ptr
+   */
+  template <typename T> ElementDeleter(const std::default_delete<T> &) {}
+
+  void operator()(Element *element) const {
+    if (!pool) {
+      delete element;
+      return;
+    }
+    void *memory = dynamic_cast<void *>(element);
+    element->~Element();
+    pool->deallocate(memory, size);
+  }
+
+  /** @brief The pool the element was allocated from, if any **/
+  ElementPool *pool = NULL;
+
+  /** @brief The size of the element **/
+  size_t size = 0;
+};
+
+class Text : public Element {
+public:
+  Text(int x, int y, const std::string &text) : Element(x, y), m_text(text) {
+    m_width = displayWidth(m_text, m_ascii);
+    widen();
+  }
+
+  /**
+   * @brief Constructor sharing the text with other elements
+   *
+   * The text is copied on its first change only.
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param text The shared text.
+   */
+  Text(int x, int y, std::shared_ptr<const std::string> text)
+      : Element(x, y), m_shared(std::move(text)) {
+    if (!m_shared) {
+      throw CursesException("No text provided.");
+    }
+    m_width = displayWidth(*m_shared, m_ascii);
+    widen();
+  }
+
+  virtual ~Text() = default;
+
+  /**
+   * @brief Gets the text of the element
+   */
+  const std::string &text() const { return m_shared ? *m_shared : m_text; }
+
+  /**
+   * @brief Changes the text of the element in place
+   *
+   * Only the cells that differ from the current text are written, and only
+   * the leftover tail is blanked when the new text is shorter.
+   *
+   * @param text The new text.
+   */
+  void setText(std::string_view text);
+
+  /**
+   * @brief Changes the text of the element from a printf-style format
+   *
+   * @param format The format string.
+   */
+  void format(const char *format, ...);
+
+  /**
+   * @copydoc Element::rows()
+   */
+  int rows() const { return 1; }
+
+  /**
+   * @brief The number of cols occupied by the text on the terminal
+   *
+   * This is measured once when the text is set, and differs from the
+   * number of bytes for non-ASCII text.
+   */
+  int cols() const { return m_width; }
+
+  /** @brief The style of the text **/
+  const Style &style() const { return m_style; }
+
+  /**
+   * @brief Changes the style of the text
+   *
+   * @param style The new style.
+   */
+  void setStyle(const Style &style);
+
+  void draw(WINDOW *parent) {
+    applyStyle(parent, m_style);
+    put(parent);
+  }
+
+private:
+  /**
+   * @brief Writes the whole text
+   *
+   * With SIMPLECURSES_WIDECHAR defined, non-ASCII text is written as wide
+   * characters. Otherwise it is handed to curses as is, which ncursesw
+   * decodes in the encoding of the locale.
+   */
+  void put(WINDOW *window) {
+#ifdef SIMPLECURSES_WIDECHAR
+    if (!m_ascii) {
+      mvwaddnwstr(window, y(), x(), m_wide.data(), m_wide.size());
+      return;
+    }
+#endif
+    mvwaddnstr(window, y(), x(), text().data(), text().size());
+  }
+
+  /**
+   * @brief Decodes non-ASCII text for the wide-character curses API
+   */
+  void widen() {
+#ifdef SIMPLECURSES_WIDECHAR
+    m_wide.clear();
+    if (m_ascii) {
+      return;
+    }
+    const std::string &text = this->text();
+    std::mbstate_t state = std::mbstate_t();
+    size_t i = 0;
+    while (i < text.size()) {
+      wchar_t wc;
+      size_t length =
+          std::mbrtowc(&wc, text.data() + i, text.size() - i, &state);
+      if (length == static_cast<size_t>(-1) ||
+          length == static_cast<size_t>(-2)) {
+        state = std::mbstate_t();
+        wc = static_cast<unsigned char>(text[i]);
+        length = 1;
+      }
+      m_wide.push_back(wc);
+      i += std::max<size_t>(length, 1);
+    }
+#endif
+  }
+
+  std::string m_text;
+
+  /** @brief The text shared with other elements, until it changes **/
+  std::shared_ptr<const std::string> m_shared;
+
+#ifdef SIMPLECURSES_WIDECHAR
+  /** @brief The decoded text, if it is not ASCII **/
+  std::wstring m_wide;
+#endif
+
+  /** @brief The number of cols occupied by the text **/
+  int m_width;
+
+  /** @brief Whether the text is only made of ASCII characters **/
+  bool m_ascii;
+
+  Style m_style;
+};
+
+/**
+ * @brief An immutable set of texts, shared by any number of stamps
+ *
+ * Static chrome, like headers and help text, is built once and drawn by a
+ * Stamp on every screen, without elements or copies of the texts per
+ * screen. Window::unshare() turns a stamp into elements once its texts
+ * need to change, and those elements still share the texts they don't
+ * change:
+ *
+ * @code
+ * auto chrome = std::make_shared<Template>();
+ * chrome->add("title", 0, 0, "Orders").add("help", 0, 1, "q: quit");
+ * screen.emplace<Stamp>("chrome", 0, 0, chrome);
+ * @endcode
+ */
+class Template {
+public:
+  /**
+   * @brief A text of a template
+   */
+  struct Entry {
+    /** @brief The name of the text once unshared **/
+    std::string name;
+    int x;
+    int y;
+    std::shared_ptr<const std::string> text;
+    /** @brief The number of cols occupied by the text **/
+    int width;
+    Style style;
+  };
+
+  /**
+   * @brief Adds a text
+   *
+   * Templates are meant to be built before they are shared, as the stamps
+   * using a template are not redrawn when it changes.
+   *
+   * @param name The name of the text once unshared.
+   * @param x The x coordinate relative to the stamp
+   * @param y The y coordinate relative to the stamp
+   * @param text The text.
+   * @param style The style of the text.
+   * @return The template.
+   */
+  Template &add(const std::string &name, int x, int y, const std::string &text,
+                const Style &style = Style()) {
+    bool ascii;
+    int width = displayWidth(text, ascii);
+    m_entries.push_back(Entry{name, x, y,
+                              std::make_shared<const std::string>(text),
+                              width, style});
+    m_rows = std::max(m_rows, y + 1);
+    m_cols = std::max(m_cols, x + width);
+    return *this;
+  }
+
+  /** @brief The texts of the template **/
+  const std::vector<Entry> &entries() const { return m_entries; }
+
+  /** @brief The number of rows spanned by the texts **/
+  int rows() const { return m_rows; }
+
+  /** @brief The number of cols spanned by the texts **/
+  int cols() const { return m_cols; }
+
+private:
+  std::vector<Entry> m_entries;
+
+  int m_rows = 0;
+
+  int m_cols = 0;
+};
+
+/**
+ * @brief Draws a template shared with other windows or screens
+ */
+class Stamp : public Element {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param shape The template.
+   */
+  Stamp(int x, int y, std::shared_ptr<const Template> shape)
+      : Element(x, y), m_shape(std::move(shape)) {
+    if (!m_shape || m_shape->entries().empty()) {
+      throw CursesException("The template is empty");
+    }
+  }
+
+  /** @brief The template drawn by the stamp **/
+  const std::shared_ptr<const Template> &shape() const { return m_shape; }
+
+  int rows() const { return m_shape->rows(); }
+
+  int cols() const { return m_shape->cols(); }
+
+  void draw(WINDOW *parent) {
+    for (const Template::Entry &entry : m_shape->entries()) {
+      applyStyle(parent, entry.style);
+      mvwaddnstr(parent, y() + entry.y, x() + entry.x, entry.text->data(),
+                 entry.text->size());
+    }
+  }
+
+private:
+  std::shared_ptr<const Template> m_shape;
+};
+
+/**
+ * @brief A single-line view of a text owned by the caller
+ *
+ * The text isn't copied: it is read from the caller's buffer whenever the
+ * view is drawn, and poll() redraws it when the generation counter the
+ * caller increments after every change has moved. Nothing is compared
+ * while the generation stands still. Each byte takes up one col, so
+ * non-ASCII text belongs in a Text element.
+ *
+ * @code
+ * std::string_view price(level.text, level.length);
+ * TextView &view = screen.emplace<TextView>("price", 0, 0, 12, price,
+ *                                           level.generation);
+ * screen.onFrame([&](Screen &) { view.poll(); });
+ * @endcode
+ */
+class TextView : public Element {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param cols The width of the view, to which the text is truncated
+   * @param text The text, read through the view when drawn; both must
+   * outlive the element.
+   * @param generation The counter the caller increments after every change
+   * of the text, which must outlive the element.
+   */
+  TextView(int x, int y, int cols, const std::string_view &text,
+           const std::atomic<uint64_t> &generation)
+      : Element(x, y), m_cols(cols), m_text(&text),
+        m_generation(&generation),
+        m_drawn(generation.load(std::memory_order_acquire)) {
+    if (cols <= 0) {
+      throw CursesException("A text view must be at least one col wide");
+    }
+  }
+
+  /**
+   * @brief A temporary text, such as a converted string or literal, would
+   * be gone before the view is drawn, so only lvalues are accepted
+   */
+  TextView(int x, int y, int cols, const std::string_view &&text,
+           const std::atomic<uint64_t> &generation) = delete;
+
+  /** @brief Nor is a temporary generation counter accepted **/
+  TextView(int x, int y, int cols, const std::string_view &text,
+           const std::atomic<uint64_t> &&generation) = delete;
+
+  int rows() const { return 1; }
+
+  int cols() const { return m_cols; }
+
+  /** @brief The style of the text **/
+  const Style &style() const { return m_style; }
+
+  /**
+   * @brief Changes the style of the text
+   *
+   * @param style The new style.
+   */
+  void setStyle(const Style &style);
+
+  /**
+   * @brief Redraws the text if its generation moved since it was drawn
+   *
+   * A change made while the text is read is caught by the next poll(), as
+   * the generation it bumps is newer than the one read before.
+   *
+   * @return Whether the text was redrawn.
+   */
+  bool poll();
+
+  void draw(WINDOW *parent) {
+    m_drawn = m_generation->load(std::memory_order_acquire);
+    applyStyle(parent, m_style);
+    int length = static_cast<int>(std::min<size_t>(m_text->size(), m_cols));
+    mvwaddnstr(parent, y(), x(), m_text->data(), length);
+    if (length < m_cols) {
+      applyAttributes(parent, A_NORMAL, 0);
+      mvwhline(parent, y(), x() + length, ' ', m_cols - length);
+    }
+  }
+
+private:
+  int m_cols;
+
+  /** @brief The text of the caller **/
+  const std::string_view *m_text;
+
+  /** @brief The generation counter of the caller **/
+  const std::atomic<uint64_t> *m_generation;
+
+  /** @brief The generation last drawn **/
+  uint64_t m_drawn;
+
+  Style m_style;
+};
+
+/**
+ * @brief A number read from a variable or getter of the caller
+ *
+ * The number is formatted right-aligned with std::to_chars into a buffer
+ * inside the field, and poll() only writes the characters that differ
+ * from those shown, after checking that the value changed at all.
+ * Numbers too wide for the field are shown as #s.
+ *
+ * @code
+ * std::atomic<double> price{0};
+ * NumberField<double> &field =
+ *     screen.emplace<NumberField<double>>("price", 0, 0, 10, price, 2);
+ * screen.onFrame([&](Screen &) { field.poll(); });
+ * @endcode
+ *
+ * @tparam T The type of the number
+ */
+template <typename T> class NumberField : public Element {
+public:
+  static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value,
+                "Only numbers can be shown in a number field");
+
+  /** @brief The widest field **/
+  static constexpr int MaxCols = 32;
+
+  /**
+   * @brief Constructor for a number in an atomic variable
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param cols The width of the field
+   * @param value The variable, which must outlive the element.
+   * @param precision The number of decimals of floating-point numbers.
+   */
+  NumberField(int x, int y, int cols, const std::atomic<T> &value,
+              int precision = 0)
+      : Element(x, y), m_cols(cols), m_precision(precision), m_atomic(&value) {
+    start();
+  }
+
+  /**
+   * @brief Constructor for a number returned by a getter
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param cols The width of the field
+   * @param getter The getter, called by every poll() and draw().
+   * @param precision The number of decimals of floating-point numbers.
+   */
+  NumberField(int x, int y, int cols, std::function<T()> getter,
+              int precision = 0)
+      : Element(x, y), m_cols(cols), m_precision(precision), m_atomic(NULL),
+        m_getter(std::move(getter)) {
+    if (!m_getter) {
+      throw CursesException("No getter provided.");
+    }
+    start();
+  }
+
+  /**
+   * @brief A temporary variable would be gone before the field is drawn,
+   * so only lvalues are accepted
+   */
+  NumberField(int x, int y, int cols, const std::atomic<T> &&value,
+              int precision = 0) = delete;
+
+  int rows() const { return 1; }
+
+  int cols() const { return m_cols; }
+
+  /** @brief The value last shown **/
+  T value() const { return m_value; }
+
+  /** @brief The style of the number **/
+  const Style &style() const { return m_style; }
+
+  /**
+   * @brief Changes the style of the number
+   *
+   * @param style The new style.
+   */
+  void setStyle(const Style &style);
+
+  /**
+   * @brief Shows the current value, writing only the characters that
+   * changed
+   *
+   * @return Whether any character was written.
+   */
+  bool poll();
+
+  void draw(WINDOW *parent) {
+    m_value = read();
+    format(m_value, m_cells);
+    applyStyle(parent, m_style);
+    mvwaddnstr(parent, y(), x(), m_cells, m_cols);
+  }
+
+private:
+  void start() {
+    if (m_cols <= 0 || m_cols > MaxCols) {
+      throw CursesException("A number field must be 1 to 32 cols wide");
+    }
+    m_value = read();
+    format(m_value, m_cells);
+  }
+
+  T read() const {
+    return m_atomic ? m_atomic->load(std::memory_order_relaxed) : m_getter();
+  }
+
+  /**
+   * @brief Formats a number right-aligned in the width of the field
+   */
+  void format(T value, char *cells) const {
+    char digits[MaxCols];
+    std::to_chars_result result;
+    if constexpr (std::is_floating_point<T>::value) {
+      result = std::to_chars(digits, digits + m_cols, value,
+                             std::chars_format::fixed, m_precision);
+    } else {
+      result = std::to_chars(digits, digits + m_cols, value);
+    }
+    if (result.ec != std::errc()) {
+      std::fill_n(cells, m_cols, '#');
+      return;
+    }
+    int length = result.ptr - digits;
+    std::fill_n(cells, m_cols - length, ' ');
+    std::copy(digits, result.ptr, cells + m_cols - length);
+  }
+
+  int m_cols;
+
+  int m_precision;
+
+  /** @brief The variable holding the number, if any **/
+  const std::atomic<T> *m_atomic;
+
+  /** @brief The getter returning the number, without a variable **/
+  std::function<T()> m_getter;
+
+  /** @brief The value last shown **/
+  T m_value;
+
+  /** @brief The characters last shown **/
+  char m_cells[MaxCols];
+
+  Style m_style;
+};
+
+/**
+ * @brief How an item of a box layout is sized along the axis of the box
+ */
+struct Constraints {
+  /**
+   * @brief The share of the space left over by the minimum sizes
+   *
+   * Items with no weight keep their minimum size.
+   */
+  unsigned weight = 1;
+
+  /** @brief The minimum size **/
+  int min = 0;
+
+  /** @brief The maximum size **/
+  int max = INT_MAX;
+};
+
+/**
+ * @brief Lays out the child windows of a window in rows or columns
+ *
+ * Each item of a box is either a child window or a nested box, and takes
+ * up the whole box across its axis. Along it, every item gets its minimum
+ * size and the rest of the space is shared by weight, up to the maximum
+ * sizes.
+ *
+ * The minimum size of each box is measured once and cached, and each box
+ * remembers the region it was last arranged in. A box is only arranged
+ * again when its region or its items changed, so resizes and insertions
+ * only touch the boxes that changed, and only the windows that moved are
+ * repainted. Arranging is deferred to the next update of the window.
+ *
+ * @code
+ * BoxLayout &root = screen.setLayout(BoxLayout::Horizontal);
+ * root.add(screen.find("sidebar"), Constraints{0, 20});
+ * BoxLayout &main = root.addBox(BoxLayout::Vertical);
+ * main.add(screen.find("log"), Constraints{2});
+ * main.add(screen.find("status"), Constraints{0, 3});
+ * @endcode
+ */
+class BoxLayout {
+public:
+  /** @brief The axis along which the items are stacked **/
+  enum Direction { Horizontal, Vertical };
+
+  BoxLayout(const BoxLayout &) = delete;
+  BoxLayout &operator=(const BoxLayout &) = delete;
+
+  /**
+   * @brief Adds a child window as the last item of the box
+   *
+   * The window must be removed from the layout before it is removed from
+   * its container. A pad is given the region it shows, and keeps the size
+   * of its content; popups don't move, and can't be laid out.
+   *
+   * @param window The handle of the window in the window owning the
+   * layout.
+   * @param constraints How the window is sized.
+   * @return The index of the item.
+   */
+  size_t add(ElementId window, const Constraints &constraints = Constraints());
+
+  /**
+   * @brief Adds a nested box as the last item of the box
+   *
+   * @param direction The axis of the nested box.
+   * @param gap The number of cells between its items.
+   * @param constraints How the nested box is sized.
+   * @return The nested box.
+   */
+  BoxLayout &addBox(Direction direction, int gap = 0,
+                    const Constraints &constraints = Constraints());
+
+  /**
+   * @brief Changes how an item is sized
+   *
+   * @param index The index of the item.
+   * @param constraints The new constraints.
+   */
+  void setConstraints(size_t index, const Constraints &constraints);
+
+  /**
+   * @brief Removes an item, and its own items if it is a box
+   *
+   * The windows stay where they are.
+   *
+   * @param index The index of the item.
+   */
+  void remove(size_t index);
+
+  /** @brief The number of items **/
+  size_t size() const { return m_items.size(); }
+
+  /**
+   * @brief The minimum size of the box along an axis
+   *
+   * @param axis The axis.
+   */
+  int minimum(Direction axis);
+
+private:
+  friend class Window;
+
+  /** @brief A window, or a nested box, and how it is sized **/
+  struct Item {
+    ElementId window;
+    std::unique_ptr<BoxLayout> box;
+    Constraints constraints;
+
+    /** @brief The size given by the latest arrangement **/
+    int size;
+  };
+
+  /** @brief A window to move, and its old and new bounds **/
+  struct Move {
+    Window *window;
+    Rect from;
+    Rect to;
+  };
+
+  BoxLayout(Window *owner, BoxLayout *parent, Direction direction, int gap)
+      : m_owner(owner), m_parent(parent), m_direction(direction),
+        m_gap(gap) {}
+
+  /**
+   * @brief Arranges the items in a region, if anything changed
+   *
+   * @param rect The region, relative to the window owning the layout.
+   * @param moves The windows to move, appended to.
+   */
+  void arrange(const Rect &rect, std::vector<Move> &moves);
+
+  /**
+   * @brief Sizes the items along the axis of the box
+   *
+   * @param space The space left by the gaps.
+   */
+  void distribute(int space);
+
+  /**
+   * @brief The minimum size of an item along an axis
+   */
+  int minimum(Item &item, Direction axis) {
+    int min = axis == m_direction ? item.constraints.min : 0;
+    if (item.box) {
+      min = std::max(min, item.box->minimum(axis));
+    }
+    return min;
+  }
+
+  /**
+   * @brief Discards the cached measures and arrangements up to the root,
+   * and schedules the window owning the layout to be arranged again
+   */
+  void invalidate();
+
+  Item &item(size_t index) {
+    if (index >= m_items.size()) {
+      throw CursesException("No such item");
+    }
+    return m_items[index];
+  }
+
+  /** @brief The window whose children are laid out **/
+  Window *m_owner;
+
+  /** @brief The box containing this one, if any **/
+  BoxLayout *m_parent;
+
+  Direction m_direction;
+
+  /** @brief The number of cells between the items **/
+  int m_gap;
+
+  std::vector<Item> m_items;
+
+  /** @brief The region of the latest arrangement **/
+  Rect m_rect = Rect{0, 0, 0, 0};
+
+  /** @brief Whether m_rect is still arranged **/
+  bool m_arranged = false;
+
+  /** @brief The cached minimum sizes, by axis **/
+  int m_minimum[2] = {0, 0};
+
+  /** @brief Whether m_minimum is up to date **/
+  bool m_measured = false;
+
+  /** @brief The moves of the latest arrangement, kept to reuse them **/
+  std::vector<Move> m_moves;
+};
+
+/**
+ * @brief A window in the interface
+ */
+class Window : public Element {
+public:
+  Window(int x, int y, int rows, int cols, bool border)
+      : Element(x, y), m_rows(rows), m_cols(cols), m_border(border),
+        m_window(NULL) {
+    if (m_border) {
+      m_rows--;
+      m_cols--;
+    }
+  }
+
+  /**
+   * @brief Destructor
+   */
+  virtual ~Window() {
+    // The subwindows must be deleted before their parent.
+    m_slots.clear();
+    delwin(m_window);
+  }
+
+  /**
+   * @brief Updates the screen with the changes in the window
+   *
+   * Only the lines damaged since the last update are touched, so the
+   * output scales with what changed rather than with the window size.
+   */
+  void update() {
+    prepare();
+    touchDamaged();
+    wrefresh(m_window);
+    if (Instrumentation *instrumentation = this->instrumentation()) {
+      instrumentation->frame.refreshes++;
+      instrumentation->frame.updates++;
+    }
+  }
+
+  /**
+   * @brief Marks a region of the window as changed
+   *
+   * The damage is propagated to the containing windows, since they share
+   * their memory with this one but are not aware of its changes.
+   *
+   * @param rect The region, relative to the window.
+   */
+  void damage(const Rect &rect) {
+    if (!m_window) {
+      return;
+    }
+    int lines = getmaxy(m_window);
+    if (m_dirty.size() != static_cast<size_t>(lines)) {
+      m_dirty.resize(lines, false);
+    }
+    int first = std::max(rect.y, 0);
+    int last = std::min(rect.y + rect.rows, lines);
+    for (int i = first; i < last; i++) {
+      m_dirty[i] = true;
+    }
+    m_damaged = true;
+    if (parent()) {
+      damageParent(rect);
+    }
+  }
+
+  /**
+   * @brief Marks a region of the window as changed by one of its elements
+   *
+   * Elements drawn above the element that overlap the region were drawn
+   * over, and are repainted on the next update.
+   *
+   * @param rect The region, relative to the window.
+   * @param source The element that changed.
+   */
+  void damage(const Rect &rect, const Element &source) {
+    damage(rect);
+    if (!m_overlapping || !m_window) {
+      return;
+    }
+    size_t first = source.m_id == Beneath ? 0 : depth(source.m_id) + 1;
+    for (ElementId id : query(rect)) {
+      Slot &slot = m_slots[id];
+      if (slot.depth >= first && !slot.overlaid && !slot.culled) {
+        slot.overdrawn = true;
+        m_overdrawn = true;
+      }
+    }
+  }
+
+  /** @brief The curses window backing the window **/
+  WINDOW *handle() const { return m_window; }
+
+  /**
+   * @brief Checks whether a region fits in the window
+   *
+   * @param rect The region, relative to the window.
+   */
+  bool fits(const Rect &rect) const {
+    return (rect.x + rect.cols <= m_cols) && (rect.y + rect.rows <= m_rows);
+  }
+
+  /**
+   * @copydoc Element::rows()
+   */
+  int rows() const { return m_rows; }
+
+  /**
+   * @copydoc Element::cols()
+   */
+  int cols() const { return m_cols; }
+
+  /**
+   * @brief Draws the window and all of its elements
+   *
+   * @copydetails Element::draw()
+   */
+  void draw(WINDOW *parent) {
+    if (!m_window) {
+      create(parent);
+      if (!m_window) {
+        return;
+      }
+    }
+    arrange(false);
+    werase(m_window);
+    drawBorder();
+    drawBeneath(NULL);
+    for (ElementId id : m_order) {
+      if (id != Removed && !m_slots[id].culled) {
+        drawChild(*m_slots[id].element, m_slots[id].name);
+      }
+    }
+  }
+
+  /** @brief The style of the border **/
+  const Style &borderStyle() const { return m_borderStyle; }
+
+  /**
+   * @brief Changes the style of the border
+   *
+   * @param style The new style.
+   */
+  void setBorderStyle(const Style &style) {
+    if (style == m_borderStyle) {
+      return;
+    }
+    m_borderStyle = style;
+    if (m_window && m_border) {
+      drawBorder();
+      damage(Rect{0, 0, m_rows, m_cols});
+    }
+  }
+
+  /**
+   * @brief The color pairs of the screen showing the window
+   *
+   * @return The color pairs, or NULL if the window isn't on a screen.
+   */
+  virtual ColorPairs *colorPairs() {
+    return parent() ? parent()->colorPairs() : NULL;
+  }
+
+  /**
+   * @brief Makes the terminal showing the window the current one of curses
+   *
+   * Curses creates windows and pads on its current terminal, which is only
+   * ever another one when a process drives several screens.
+   */
+  virtual void activate() {
+    if (parent()) {
+      parent()->activate();
+    }
+  }
+
+  /**
+   * @brief Moves and resizes the window within its container
+   *
+   * Nothing is done when the bounds don't change. Otherwise the old region
+   * is blanked, the curses window is resized in place, or recreated if it
+   * moved, and only the subtree of the window is repainted.
+   *
+   * @param rect The new bounds, relative to the container.
+   */
+  void setBounds(const Rect &rect) {
+    Rect old = bounds();
+    if (rect == old) {
+      return;
+    }
+    Window *container = parent();
+    if (container && !container->fits(rect)) {
+      throw CursesException("Element doesn't fit in window");
+    }
+    if (container && container->handle()) {
+      container->erase(old);
+      if (staged()) {
+        container->expose(old);
+      }
+    }
+    place(rect, true);
+    if (container && container->handle()) {
+      bool overlapping = container->m_overlapping;
+      container->cull(old);
+      container->cull(rect);
+      if (overlapping || container->m_overlapping) {
+        container->exposed(*this, old);
+      }
+    }
+  }
+
+  /**
+   * @brief Lays out the child windows of the window in a box
+   *
+   * This replaces any previous layout, and the windows are arranged on the
+   * next update.
+   *
+   * @param direction The axis of the box.
+   * @param gap The number of cells between its items.
+   * @return The box, to add the windows to.
+   */
+  BoxLayout &setLayout(BoxLayout::Direction direction, int gap = 0) {
+    m_layout.reset(new BoxLayout(this, NULL, direction, gap));
+    m_layout->invalidate();
+    return *m_layout;
+  }
+
+  /**
+   * @brief Adds an element to the window
+   *
+   * @param element The element to add.
+   * @return The handle of the element.
+   */
+  template <typename WindowElement>
+  ElementId add(std::unique_ptr<WindowElement> element) {
+    return insert(std::move(element));
+  }
+
+  /**
+   * @brief Adds a named element to the window
+   *
+   * An element previously added with the same name is replaced.
+   *
+   * @param name The name of the element.
+   * @param element The element to add.
+   * @return The element.
+   */
+  template <typename WindowElement>
+  WindowElement &add(const std::string &name,
+                     std::unique_ptr<WindowElement> element) {
+    WindowElement *ref = element.get();
+    bind(name, insert(std::move(element), &name));
+    return *ref;
+  }
+
+  /**
+   * @brief Constructs a named element in the storage pooled by the window
+   *
+   * This avoids an allocation per element, and the storage is released all
+   * at once when the window is destroyed. An element previously added with
+   * the same name is replaced.
+   *
+   * @code
+   * window.emplace<Text>("field", 0, 0, "text");
+   * @endcode
+   *
+   * @param name The name of the element.
+   * @param args The arguments to the constructor of the element.
+   * @return The element.
+   */
+  template <typename WindowElement, typename... Args>
+  WindowElement &emplace(const std::string &name, Args &&...args) {
+    static_assert(std::is_base_of<Element, WindowElement>::value,
+                  "Only elements can be emplaced");
+    static_assert(alignof(WindowElement) <= alignof(std::max_align_t),
+                  "Over-aligned elements can't be pooled");
+    ElementId id =
+        insert(allocate<WindowElement>(std::forward<Args>(args)...), &name);
+    bind(name, id);
+    return static_cast<WindowElement &>(get(id));
+  }
+
+  /**
+   * @brief Gets an element in the window
+   *
+   * @param id The handle of the element.
+   */
+  Element &get(ElementId id) const {
+    if (id >= m_slots.size() || !m_slots[id].element) {
+      throw CursesException("No such element");
+    }
+    return *m_slots[id].element;
+  }
+
+  /**
+   * @brief Gets the handle of a named element in the window
+   *
+   * @param name The name of the element.
+   */
+  ElementId find(const std::string &name) const { return m_names.at(name); }
+
+  /**
+   * @brief Remove an element in the window
+   *
+   * @param name The name of the element to remove.
+   */
+  void remove(const std::string &name) { remove(find(name)); }
+
+  /**
+   * @brief Replaces a stamp with elements that can change
+   *
+   * The stamp is replaced by a window of the same bounds and name, on top of
+   * the other elements, holding a Text for every text of the template,
+   * named after them. The texts are shared with the template until they
+   * change.
+   *
+   * @param name The name of the stamp.
+   * @return The window replacing the stamp.
+   */
+  Window &unshare(const std::string &name) {
+    ElementId id = find(name);
+    Stamp *stamp = dynamic_cast<Stamp *>(&get(id));
+    if (!stamp) {
+      throw CursesException("No such stamp");
+    }
+    std::shared_ptr<const Template> shape = stamp->shape();
+    Rect rect = stamp->bounds();
+    remove(id);
+    Window &window =
+        emplace<Window>(name, rect.x, rect.y, rect.rows, rect.cols, false);
+    for (const Template::Entry &entry : shape->entries()) {
+      Text &text =
+          window.emplace<Text>(entry.name, entry.x, entry.y, entry.text);
+      text.setStyle(entry.style);
+    }
+    return window;
+  }
+
+  /**
+   * @brief Remove an element in the window
+   *
+   * @param id The handle of the element to remove.
+   */
+  void remove(ElementId id) {
+    Rect rect = get(id).bounds();
+    Window *window = m_slots[id].window;
+    bool staged = m_slots[id].overlaid || (window && window->staged());
+    bool overlapping = m_overlapping;
+    discard(id);
+    erase(rect);
+    if (staged) {
+      expose(rect);
+    }
+    if (window) {
+      cull(rect);
+    }
+    if (overlapping) {
+      repaint(rect, 0);
+    }
+  }
+
+  /**
+   * @brief Finds the element shown at a cell
+   *
+   * Only the elements indexed in the row of the cell are looked at, and the
+   * search goes on into the window found, if any, so that the innermost
+   * element is returned. The elements stored by a TypedWindow are not
+   * found.
+   *
+   * @param x The col, relative to the window.
+   * @param y The row, relative to the window.
+   * @return The element, or NULL if there's none.
+   */
+  virtual Element *at(int x, int y) {
+    Slot *top = NULL;
+    for (ElementId id : query(Rect{x, y, 1, 1})) {
+      Slot &slot = m_slots[id];
+      if (slot.culled) {
+        continue;
+      }
+      // Pads and popups are staged over the other elements.
+      if (!top || (slot.overlaid != top->overlaid ? slot.overlaid
+                                                  : slot.depth > top->depth)) {
+        top = &slot;
+      }
+    }
+    if (!top) {
+      return NULL;
+    }
+    Window *window = dynamic_cast<Window *>(top->element.get());
+    if (window) {
+      Element *inner = window->at(x - window->x(), y - window->y());
+      return inner ? inner : window;
+    }
+    return top->element.get();
+  }
+
+  /**
+   * @brief Moves an element above all the others in the window
+   *
+   * Only the element, and what it now covers, is repainted.
+   *
+   * @param id The handle of the element.
+   */
+  void raise(ElementId id) { restack(id, SIZE_MAX); }
+
+  /**
+   * @brief Moves an element below all the others in the window
+   *
+   * Only the element, and the elements above it that it overlaps, are
+   * repainted.
+   *
+   * @param id The handle of the element.
+   */
+  void lower(ElementId id) { restack(id, 0); }
+
+  /**
+   * @brief Blanks a region of the window
+   *
+   * Each row is cleared with a single mvwhline(), and the border is redrawn
+   * if the region reaches it.
+   *
+   * @param rect The region, relative to the window.
+   */
+  void erase(const Rect &rect) {
+    if (!m_window) {
+      return;
+    }
+    int lines, cols;
+    getmaxyx(m_window, lines, cols);
+    int left = std::max(rect.x, 0);
+    int right = std::min(rect.x + rect.cols, cols);
+    int top = std::max(rect.y, 0);
+    int bottom = std::min(rect.y + rect.rows, lines);
+    if (left >= right || top >= bottom) {
+      return;
+    }
+    applyAttributes(m_window, A_NORMAL, 0);
+    for (int i = top; i < bottom; i++) {
+      mvwhline(m_window, i, left, ' ', right - left);
+    }
+    if (left == 0 || top == 0 || right == cols || bottom == lines) {
+      drawBorder();
+    }
+    damage(Rect{left, top, bottom - top, right - left});
+  }
+
+protected:
+  /**
+   * @brief Stages the damaged windows in the tree with wnoutrefresh
+   *
+   * Damage always propagates to the containing windows, so an undamaged
+   * window has no damaged descendants and its subtree is skipped.
+   *
+   * @copydetails Element::stage()
+   */
+  bool stage(bool refresh) {
+    if (!m_damaged) {
+      return false;
+    }
+    if (refresh) {
+      touchDamaged();
+      wnoutrefresh(m_window);
+      if (Instrumentation *instrumentation = this->instrumentation()) {
+        instrumentation->frame.refreshes++;
+      }
+    } else {
+      m_dirty.assign(m_dirty.size(), false);
+      m_damaged = false;
+    }
+    bool staged = refresh;
+    for (ElementId id : m_order) {
+      if (id != Removed) {
+        staged |= m_slots[id].element->stage(refresh);
+      }
+    }
+    return staged;
+  }
+
+  /**
+   * @brief Recreates the windows of the subtree that curses truncated or
+   * moved when the terminal was resized
+   *
+   * The size of a top-level window follows the terminal. Any other window
+   * whose curses window matches its bounds, clipped to its container, is
+   * left alone and so is not repainted.
+   */
+  void resized() {
+    if (!parent()) {
+      getmaxyx(m_window, m_rows, m_cols);
+      m_dirty.assign(m_rows, false);
+      arrange(true);
+    } else if (!matches(parent()->handle())) {
+      detach();
+      draw(parent()->handle());
+      parent()->damage(bounds(), *this);
+      return;
+    }
+    for (auto &slot : m_slots) {
+      if (slot.element && !slot.culled) {
+        slot.element->resized();
+      }
+    }
+    if (m_beneath) {
+      forBeneath(&Element::resized);
+    }
+  }
+
+  /**
+   * @copydoc Element::detach()
+   */
+  void detach() {
+    for (auto &slot : m_slots) {
+      if (slot.element) {
+        slot.element->detach();
+      }
+    }
+    if (m_beneath) {
+      forBeneath(&Element::detach);
+    }
+    delwin(m_window);
+    m_window = NULL;
+    m_dirty.clear();
+    m_damaged = false;
+  }
+
+  /**
+   * @copydoc Element::prepare()
+   */
+  void prepare() {
+    if (!m_damaged) {
+      return;
+    }
+    arrange(true);
+    if (m_overdrawn) {
+      m_overdrawn = false;
+      for (size_t i = 0; i < m_order.size(); i++) {
+        if (m_order[i] == Removed) {
+          continue;
+        }
+        Slot &slot = m_slots[m_order[i]];
+        if (slot.overdrawn) {
+          slot.overdrawn = false;
+          repaint(slot.element->bounds(), i);
+        }
+      }
+    }
+    for (auto &slot : m_slots) {
+      if (slot.element) {
+        slot.element->prepare();
+      }
+    }
+    if (m_beneath) {
+      forBeneath(&Element::prepare);
+    }
+  }
+
+  /**
+   * @brief Propagates damage to the containing window
+   *
+   * @param rect The damaged region, relative to the window.
+   */
+  virtual void damageParent(const Rect &rect) {
+    parent()->damage(Rect{x() + rect.x, y() + rect.y, rect.rows, rect.cols},
+                     *this);
+  }
+
+  /**
+   * @brief Whether the window is staged on top of its container rather
+   * than sharing its memory
+   *
+   * Such windows neither cover nor are covered by their siblings.
+   */
+  virtual bool overlays() const { return false; }
+
+  /**
+   * @brief Whether the window or one of its descendants is staged on top
+   * of its container
+   */
+  bool staged() const {
+    if (overlays()) {
+      return true;
+    }
+    for (const Slot &slot : m_slots) {
+      if (slot.overlaid || (slot.window && slot.window->staged())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief Sets the size given by the bounds of the window
+   *
+   * @param rows The number of rows.
+   * @param cols The number of cols.
+   */
+  virtual void setSize(int rows, int cols) {
+    m_rows = rows;
+    m_cols = cols;
+  }
+
+  /**
+   * @brief Marks a region of the terminal as out of date
+   *
+   * A window staged on top of the others leaves its cells on the terminal
+   * when it moves or goes, while the cells of the screen under it may not
+   * have changed. The screen copies such regions to the terminal again.
+   *
+   * @param rect The region, relative to the window.
+   */
+  virtual void expose(const Rect &rect) {
+    if (parent()) {
+      parent()->expose(Rect{x() + rect.x, y() + rect.y, rect.rows, rect.cols});
+    }
+  }
+
+  /**
+   * @brief The instrumentation of the screen showing the window
+   *
+   * @return The instrumentation, or NULL unless SIMPLECURSES_STATS is
+   * defined and the window is on a screen.
+   */
+  Instrumentation *instrumentation() {
+#ifdef SIMPLECURSES_STATS
+    Window *root = this;
+    while (root->parent()) {
+      root = root->parent();
+    }
+    return root->m_instrumentation;
+#else
+    return NULL;
+#endif
+  }
+
+  /**
+   * @brief Shares instrumentation with the windows of the tree
+   *
+   * @param instrumentation The instrumentation.
+   */
+  void instrument(Instrumentation *instrumentation) {
+#ifdef SIMPLECURSES_STATS
+    m_instrumentation = instrumentation;
+#else
+    (void)instrumentation;
+#endif
+  }
+
+  /**
+   * @brief Deletes the elements and the curses window ahead of the
+   * destructor
+   */
+  void destroy() {
+    m_slots.clear();
+    delwin(m_window);
+    m_window = NULL;
+  }
+
+  /**
+   * @brief Constructs an unnamed element in the storage pooled by the
+   * window
+   *
+   * @param args The arguments to the constructor of the element.
+   * @return The handle of the element.
+   */
+  template <typename WindowElement, typename... Args>
+  ElementId construct(Args &&...args) {
+    return insert(allocate<WindowElement>(std::forward<Args>(args)...));
+  }
+
+  /**
+   * @brief Removes an element without blanking its region
+   *
+   * @param id The handle of the element.
+   */
+  void discard(ElementId id) {
+    get(id);
+    if (m_slots[id].name) {
+      m_names.erase(*m_slots[id].name);
+    }
+    release(id);
+  }
+
+  /**
+   * @brief Makes the window the parent of an element it stores by itself
+   *
+   * Such elements are drawn by drawBeneath(), beneath those of the slots,
+   * which are from then on all taken to overlap them.
+   *
+   * @param element The element.
+   */
+  void adopt(Element &element) {
+    element.m_parent = this;
+    element.m_id = Beneath;
+    m_beneath = true;
+    m_overlapping = true;
+  }
+
+  /**
+   * @brief Draws the elements stored by a derived window
+   *
+   * @param repainted The regions being repainted, to which the bounds of
+   * every element drawn are added, or NULL to draw all of them.
+   */
+  virtual void drawBeneath(std::vector<Rect> *repainted) { (void)repainted; }
+
+  /**
+   * @brief Runs a hook of the elements stored by a derived window
+   *
+   * @param hook The hook, like Element::prepare().
+   */
+  virtual void forBeneath(void (Element::*hook)()) { (void)hook; }
+
+  /**
+   * @brief Sets the curses window backing the window
+   *
+   * This allows windows not created with derwin(), like pads.
+   */
+  void setHandle(WINDOW *window) { m_window = window; }
+
+  /** @brief The lines changed since the last update **/
+  const std::vector<bool> &damagedLines() const { return m_dirty; }
+
+  /** @brief Whether the window has changed since the last update **/
+  bool damaged() const { return m_damaged; }
+
+  /**
+   * @brief Protected constructor
+   *
+   * This exists solely to allow Screen to be a special type of Window.
+   */
+  Window(int x, int y, WINDOW *window)
+      : Element(x, y), m_window(window), m_border(false) {
+    getmaxyx(window, m_rows, m_cols);
+  }
+
+private:
+  friend class BoxLayout;
+
+  /**
+   * @brief Moves and resizes the window without blanking its old region
+   *
+   * @param rect The new bounds, relative to the container.
+   * @param paint Whether to repaint the window, rather than leave it to
+   * the next draw() of the container.
+   */
+  void place(const Rect &rect, bool paint) {
+    Window *container = parent();
+    Rect old = bounds();
+    setPosition(rect.x, rect.y);
+    setSize(rect.rows, rect.cols);
+    if (container) {
+      container->reindex(*this);
+    }
+    if (!paint || !container || !container->handle()) {
+      if (m_window) {
+        detach();
+      }
+      return;
+    }
+
+    // A pad keeps its content wherever it is shown.
+    if (!overlays()) {
+      if (m_window && rect.x == old.x && rect.y == old.y && rect.rows > 0 &&
+          rect.cols > 0) {
+        m_size = clippedSize(container->handle());
+        wresize(m_window, m_size.first, m_size.second);
+      } else {
+        detach();
+      }
+    }
+    draw(container->handle());
+    for (auto &slot : m_slots) {
+      if (slot.element) {
+        slot.element->resized();
+      }
+    }
+    container->damage(rect);
+  }
+
+  /**
+   * @brief Arranges the child windows, if the layout changed
+   *
+   * The old regions of all the windows that move are blanked before any
+   * of them is repainted, so that a window growing into the old region of
+   * another one isn't blanked by it.
+   *
+   * @param paint Whether to repaint the windows that move.
+   */
+  void arrange(bool paint) {
+    if (!m_layout) {
+      return;
+    }
+    int inset = m_border ? 1 : 0;
+    std::vector<BoxLayout::Move> &moves = m_layout->m_moves;
+    moves.clear();
+    m_layout->arrange(Rect{inset, inset, std::max(m_rows - 2 * inset, 0),
+                           std::max(m_cols - 2 * inset, 0)},
+                      moves);
+    paint = paint && m_window;
+    if (paint) {
+      for (auto &move : moves) {
+        erase(move.from);
+      }
+    }
+    for (auto &move : moves) {
+      move.window->place(move.to, paint);
+    }
+    if (paint && !moves.empty()) {
+      bool overlapping = m_overlapping;
+      for (auto &move : moves) {
+        cull(move.from);
+        cull(move.to);
+      }
+      if (overlapping || m_overlapping) {
+        for (auto &move : moves) {
+          exposed(*move.window, move.from);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief The size of the curses window, clipped to its parent
+   */
+  std::pair<int, int> clippedSize(WINDOW *parent) const {
+    int lines, cols;
+    getmaxyx(parent, lines, cols);
+    return std::make_pair(std::min(m_rows, lines - y()),
+                          std::min(m_cols, cols - x()));
+  }
+
+  /**
+   * @brief Creates the curses window, clipped to its parent
+   */
+  void create(WINDOW *parent) {
+    m_size = clippedSize(parent);
+    if (m_size.first > 0 && m_size.second > 0) {
+      m_window = derwin(parent, m_size.first, m_size.second, y(), x());
+    }
+  }
+
+  /**
+   * @brief Checks whether the curses window is where it should be
+   *
+   * This also catches curses truncating the window to the terminal.
+   */
+  bool matches(WINDOW *parent) const {
+    if (!m_window) {
+      return false;
+    }
+    int top, left, lines, cols;
+    getparyx(m_window, top, left);
+    getmaxyx(m_window, lines, cols);
+    return top == y() && left == x() && std::make_pair(lines, cols) == m_size &&
+           m_size == clippedSize(parent);
+  }
+
+  /**
+   * @brief Draws the border of the window, if it has one
+   */
+  void drawBorder() {
+    if (m_border) {
+      applyStyle(m_window, m_borderStyle);
+      box(m_window, 0, 0);
+    }
+  }
+
+  /**
+   * @brief Touches the damaged lines and clears the damage
+   */
+  void touchDamaged() {
+    size_t i = 0;
+    while (i < m_dirty.size()) {
+      if (!m_dirty[i]) {
+        i++;
+        continue;
+      }
+      size_t first = i;
+      while (i < m_dirty.size() && m_dirty[i]) {
+        m_dirty[i++] = false;
+      }
+      wtouchln(m_window, first, i - first, 1);
+      if (Instrumentation *instrumentation = this->instrumentation()) {
+        instrumentation->frame.cellsTouched += (i - first) * getmaxx(m_window);
+      }
+    }
+    m_damaged = false;
+  }
+
+  typedef std::unique_ptr<Window> WindowPtr;
+  typedef std::unique_ptr<Element, ElementDeleter> ElementPtr;
+
+  /**
+   * @brief A slot in the element store
+   */
+  struct Slot {
+    /** @brief The element, or NULL if the slot is free **/
+    ElementPtr element;
+
+    /** @brief The name of the element in m_names, if any **/
+    const std::string *name;
+
+    /** @brief The element, if it is a window sharing the memory of this one **/
+    Window *window = NULL;
+
+    /** @brief Whether the element is staged on top of this window **/
+    bool overlaid = false;
+
+    /** @brief Whether the window is hidden by the windows above it **/
+    bool culled = false;
+
+    /** @brief Whether the element was drawn over by one below it **/
+    bool overdrawn = false;
+
+    /** @brief The position of the element in the stacking order **/
+    size_t depth = 0;
+
+    /** @brief The rows the element is indexed in **/
+    int top = 0;
+
+    int bottom = 0;
+
+    /** @brief The last query() that found the element **/
+    size_t visit = 0;
+
+    /** @brief The last repaint() that queued the element **/
+    size_t queued = 0;
+  };
+
+  /**
+   * @brief Draws an element, counting and tracing it when instrumented
+   *
+   * @param element The element.
+   * @param name The name of the element, if any.
+   */
+  void drawChild(Element &element, const std::string *name) {
+    Instrumentation *instrumentation = this->instrumentation();
+    if (!instrumentation) {
+      element.draw(m_window);
+      return;
+    }
+    instrumentation->frame.elementsDrawn++;
+    instrumentation->depth++;
+    auto start = std::chrono::steady_clock::now();
+    element.draw(m_window);
+    std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - start;
+    if (--instrumentation->depth == 0) {
+      instrumentation->frame.drawTime += duration;
+    }
+    if (instrumentation->trace) {
+      instrumentation->trace(
+          TraceEvent{"draw", name, &element, start, duration});
+    }
+  }
+
+  /**
+   * @brief Constructs an element in the storage pooled by the window
+   */
+  template <typename WindowElement, typename... Args>
+  ElementPtr allocate(Args &&...args) {
+    void *memory = m_pool.allocate(sizeof(WindowElement));
+    WindowElement *ref;
+    try {
+      ref = new (memory) WindowElement(std::forward<Args>(args)...);
+    } catch (...) {
+      m_pool.deallocate(memory, sizeof(WindowElement));
+      throw;
+    }
+    return ElementPtr(ref, ElementDeleter(&m_pool, sizeof(WindowElement)));
+  }
+
+  /**
+   * @brief Draws an element and stores it in a free slot
+   *
+   * @param element The element.
+   * @param name The name the element is about to be given, if any.
+   */
+  ElementId insert(ElementPtr element, const std::string *name = NULL) {
+    if (!element) {
+      throw CursesException("No element provided.");
+    }
+
+    if (!fits(element->bounds())) {
+      throw CursesException("Element doesn't fit in window");
+    }
+
+    element->m_parent = this;
+    drawChild(*element, name);
+    damage(element->bounds());
+
+    Window *window = dynamic_cast<Window *>(element.get());
+    bool overlaid = window && window->overlays();
+    if (overlaid) {
+      window = NULL;
+    }
+    Rect bounds = element->bounds();
+    ElementId id;
+    if (m_free.empty()) {
+      id = m_slots.size();
+      m_slots.push_back(Slot{std::move(element), NULL, window, overlaid});
+    } else {
+      id = m_free.back();
+      m_free.pop_back();
+      m_slots[id] = Slot{std::move(element), NULL, window, overlaid};
+    }
+    m_slots[id].element->m_id = id;
+    m_slots[id].depth = m_order.size();
+    m_order.push_back(id);
+    index(id);
+
+    // The element is drawn on top, so it can only hide what is below it.
+    if (window) {
+      cull(bounds);
+    } else if (!overlaid && !m_overlapping) {
+      for (ElementId other : query(bounds)) {
+        if (other != id && !m_slots[other].overlaid) {
+          m_overlapping = true;
+          break;
+        }
+      }
+    }
+    return id;
+  }
+
+  /**
+   * @brief Names the element in a slot, replacing any element of that name
+   */
+  void bind(const std::string &name, ElementId id) {
+    auto existing = m_names.find(name);
+    if (existing != m_names.end()) {
+      release(existing->second);
+      existing->second = id;
+      m_slots[id].name = &existing->first;
+    } else {
+      m_slots[id].name = &m_names.emplace(name, id).first->first;
+    }
+  }
+
+  /**
+   * @brief Destroys the element in a slot and frees the slot
+   *
+   * Its place in the stacking order is left empty, so that the elements
+   * above it keep their depths, and the order is compacted once half of it
+   * is empty.
+   */
+  void release(ElementId id) {
+    unindex(id);
+    size_t depth = m_slots[id].depth;
+    m_slots[id] = Slot{NULL, NULL};
+    m_order[depth] = Removed;
+    m_removed++;
+    while (!m_order.empty() && m_order.back() == Removed) {
+      m_order.pop_back();
+      m_removed--;
+    }
+    if (m_removed > m_order.size() / 2) {
+      compact();
+    }
+    m_free.push_back(id);
+  }
+
+  /**
+   * @brief Drops the empty places of the stacking order
+   */
+  void compact() {
+    m_order.erase(std::remove(m_order.begin(), m_order.end(), Removed),
+                  m_order.end());
+    m_removed = 0;
+    renumber(0);
+  }
+
+  /**
+   * @brief The position of an element in the stacking order
+   */
+  size_t depth(ElementId id) const {
+    if (id >= m_slots.size() || !m_slots[id].element) {
+      return m_order.size();
+    }
+    return m_slots[id].depth;
+  }
+
+  /**
+   * @brief Updates the positions in the stacking order from some position
+   */
+  void renumber(size_t from) {
+    for (size_t i = from; i < m_order.size(); i++) {
+      if (m_order[i] != Removed) {
+        m_slots[m_order[i]].depth = i;
+      }
+    }
+  }
+
+  /**
+   * @brief Adds an element to the buckets of the rows it spans
+   *
+   * The buckets are rebuilt first if the window changed height.
+   */
+  void index(ElementId id) {
+    if (m_buckets.size() != static_cast<size_t>(std::max(m_rows, 0))) {
+      rebuild();
+      return;
+    }
+    Slot &slot = m_slots[id];
+    Rect bounds = slot.element->bounds();
+    slot.top = std::max(bounds.y, 0);
+    slot.bottom = std::min<int>(bounds.y + bounds.rows, m_buckets.size());
+    for (int row = slot.top; row < slot.bottom; row++) {
+      m_buckets[row].push_back(id);
+    }
+  }
+
+  /**
+   * @brief Removes an element from the buckets of the rows it was indexed in
+   */
+  void unindex(ElementId id) {
+    Slot &slot = m_slots[id];
+    int bottom = std::min<int>(slot.bottom, m_buckets.size());
+    for (int row = slot.top; row < bottom; row++) {
+      std::vector<ElementId> &bucket = m_buckets[row];
+      auto found = std::find(bucket.begin(), bucket.end(), id);
+      if (found != bucket.end()) {
+        *found = bucket.back();
+        bucket.pop_back();
+      }
+    }
+    slot.top = slot.bottom = 0;
+  }
+
+  /**
+   * @brief Indexes a child again after it moved or was resized
+   */
+  void reindex(const Element &child) {
+    ElementId id = child.m_id;
+    if (id < m_slots.size() && m_slots[id].element.get() == &child) {
+      unindex(id);
+      index(id);
+    }
+  }
+
+  /**
+   * @brief Indexes all the elements again, with a bucket per row
+   */
+  void rebuild() {
+    m_buckets.resize(std::max(m_rows, 0));
+    for (auto &bucket : m_buckets) {
+      bucket.clear();
+    }
+    for (ElementId id : m_order) {
+      if (id != Removed) {
+        m_slots[id].top = m_slots[id].bottom = 0;
+        index(id);
+      }
+    }
+  }
+
+  /**
+   * @brief Finds the elements overlapping a region
+   *
+   * Only the buckets of the rows of the region are looked at, so this costs
+   * as much as the elements in those rows rather than in the window.
+   *
+   * @param rect The region.
+   * @return The handles of the elements, each found once, valid until the
+   * next query.
+   */
+  const std::vector<ElementId> &query(const Rect &rect) {
+    if (m_buckets.size() != static_cast<size_t>(std::max(m_rows, 0))) {
+      rebuild();
+    }
+    m_found.clear();
+    m_visit++;
+    int last = std::min<int>(rect.y + rect.rows, m_buckets.size());
+    for (int row = std::max(rect.y, 0); row < last; row++) {
+      for (ElementId id : m_buckets[row]) {
+        Slot &slot = m_slots[id];
+        if (slot.visit != m_visit) {
+          slot.visit = m_visit;
+          if (slot.element->bounds().intersects(rect)) {
+            m_found.push_back(id);
+          }
+        }
+      }
+    }
+    return m_found;
+  }
+
+  /**
+   * @brief Moves an element in the stacking order and repaints it
+   *
+   * @param id The handle of the element.
+   * @param depth Its new position in the stacking order, at most the top.
+   */
+  void restack(ElementId id, size_t depth) {
+    Rect rect = get(id).bounds();
+    if (m_removed) {
+      compact();
+    }
+    depth = std::min(depth, m_order.size() - 1);
+    size_t current = this->depth(id);
+    if (current == depth) {
+      return;
+    }
+    m_order.erase(m_order.begin() + current);
+    m_order.insert(m_order.begin() + depth, id);
+    renumber(std::min(current, depth));
+    cull(rect);
+    repaint(rect, depth);
+  }
+
+  /**
+   * @brief Hides the windows entirely covered by windows above them
+   *
+   * The curses windows of the hidden windows are freed, so that their
+   * elements stop drawing until they are uncovered, when they are drawn
+   * again. Only the windows overlapping a region that changed can be
+   * hidden or uncovered by the change, so the others keep their state.
+   *
+   * This also finds out whether the change made any elements overlap.
+   * Once set, that stays set when the elements stop overlapping, which
+   * only costs repaints.
+   *
+   * @param changed The region in which an element was inserted, removed,
+   * moved or restacked.
+   */
+  void cull(const Rect &changed) {
+    // covers() and repaint() query the buckets too, so keep a copy.
+    m_culling.clear();
+    for (ElementId id : query(changed)) {
+      if (!m_slots[id].overlaid) {
+        m_culling.push_back(id);
+      }
+    }
+    // Any new overlap involves the element that changed, which is among
+    // the elements in the region.
+    for (size_t i = 0; i < m_culling.size() && !m_overlapping; i++) {
+      Rect bounds = m_slots[m_culling[i]].element->bounds();
+      for (size_t j = 0; j < m_culling.size() && !m_overlapping; j++) {
+        m_overlapping =
+            j != i && m_slots[m_culling[j]].element->bounds().intersects(bounds);
+      }
+    }
+    m_uncovered.clear();
+    for (ElementId id : m_culling) {
+      Slot &slot = m_slots[id];
+      if (!slot.window) {
+        continue;
+      }
+      bool covered = covers(slot.element->bounds(), slot.depth + 1);
+      if (covered && !slot.culled) {
+        slot.culled = true;
+        slot.window->detach();
+      } else if (!covered && slot.culled) {
+        slot.culled = false;
+        m_uncovered.push_back(slot.depth);
+      }
+    }
+    std::sort(m_uncovered.begin(), m_uncovered.end());
+    for (size_t depth : m_uncovered) {
+      repaint(m_slots[m_order[depth]].element->bounds(), depth);
+    }
+  }
+
+  /**
+   * @brief Checks whether a region is entirely covered by windows
+   *
+   * Only the buckets of the rows of the region are looked at, and the
+   * rows outside the window are never covered.
+   *
+   * @param rect The region.
+   * @param from The position in the stacking order of the first window to
+   * consider.
+   */
+  bool covers(const Rect &rect, size_t from) {
+    if (rect.y < 0 || rect.y + rect.rows > static_cast<int>(m_buckets.size())) {
+      return false;
+    }
+    for (int row = rect.y; row < rect.y + rect.rows; row++) {
+      m_spans.clear();
+      for (ElementId id : m_buckets[row]) {
+        const Slot &slot = m_slots[id];
+        if (!slot.window || slot.depth < from) {
+          continue;
+        }
+        Rect other = slot.element->bounds();
+        m_spans.push_back(std::make_pair(other.x, other.x + other.cols));
+      }
+      std::sort(m_spans.begin(), m_spans.end());
+      int reached = rect.x;
+      for (auto &span : m_spans) {
+        if (span.first > reached) {
+          break;
+        }
+        reached = std::max(reached, span.second);
+      }
+      if (reached < rect.x + rect.cols) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief Repaints a region, in stacking order
+   *
+   * The elements from a position in the stacking order that overlap the
+   * region are drawn, and so are those above them that they overlap in
+   * turn, since elements are drawn whole.
+   *
+   * @param rect The region.
+   * @param from The position in the stacking order of the first element to
+   * consider.
+   */
+  void repaint(const Rect &rect, size_t from) {
+    if (!m_window) {
+      return;
+    }
+    m_repainted.clear();
+    m_repainted.push_back(rect);
+    if (from == 0) {
+      drawBeneath(&m_repainted);
+    }
+    // The elements are drawn from the bottom up, each queueing the
+    // elements above it that it overlaps.
+    m_repaints++;
+    m_queue.clear();
+    auto lower = [this](ElementId a, ElementId b) {
+      return m_slots[a].depth > m_slots[b].depth;
+    };
+    auto enqueue = [&](const Rect &region, size_t above) {
+      for (ElementId id : query(region)) {
+        Slot &slot = m_slots[id];
+        if (slot.depth >= above && slot.queued != m_repaints) {
+          slot.queued = m_repaints;
+          m_queue.push_back(id);
+          std::push_heap(m_queue.begin(), m_queue.end(), lower);
+        }
+      }
+    };
+    size_t regions = m_repainted.size();
+    for (size_t i = 0; i < regions; i++) {
+      enqueue(m_repainted[i], from);
+    }
+    while (!m_queue.empty()) {
+      std::pop_heap(m_queue.begin(), m_queue.end(), lower);
+      Slot &slot = m_slots[m_queue.back()];
+      m_queue.pop_back();
+      if (slot.overlaid || slot.culled) {
+        continue;
+      }
+      Rect bounds = slot.element->bounds();
+      drawChild(*slot.element, slot.name);
+      m_repainted.push_back(bounds);
+      enqueue(bounds, slot.depth + 1);
+    }
+    for (const Rect &repainted : m_repainted) {
+      damage(repainted);
+    }
+  }
+
+  /**
+   * @brief Repaints what a window that moved uncovered, and what now
+   * covers it
+   *
+   * What covers it is repainted even when it's culled, as it was drawn
+   * when it was placed.
+   *
+   * @param window The window.
+   * @param from The old bounds of the window.
+   */
+  void exposed(const Window &window, const Rect &from) {
+    repaint(from, 0);
+    repaint(window.bounds(), depth(window.m_id) + 1);
+  }
+
+  /** @brief The handle of the elements drawn by drawBeneath() **/
+  static constexpr ElementId Beneath = SIZE_MAX;
+
+  /** @brief The place of a removed element in the stacking order **/
+  static constexpr ElementId Removed = SIZE_MAX - 1;
+
+  WINDOW *m_window;
+
+  bool m_border;
+
+  int m_rows;
+
+  int m_cols;
+
+  /** @brief The style of the border **/
+  Style m_borderStyle;
+
+  /** @brief The size the curses window was given **/
+  std::pair<int, int> m_size;
+
+  /** @brief The storage of the emplaced elements, outliving them **/
+  ElementPool m_pool;
+
+  /** @brief The elements, indexed by handle **/
+  std::vector<Slot> m_slots;
+
+  /** @brief The free slots in m_slots **/
+  std::vector<ElementId> m_free;
+
+  /** @brief The handles of the named elements **/
+  std::unordered_map<std::string, ElementId> m_names;
+
+  /** @brief The lines changed since the last update **/
+  std::vector<bool> m_dirty;
+
+  /** @brief Whether any line is in m_dirty **/
+  bool m_damaged = false;
+
+  /** @brief The layout of the child windows, if any **/
+  std::unique_ptr<BoxLayout> m_layout;
+
+#ifdef SIMPLECURSES_STATS
+  /** @brief The instrumentation of the tree, if this is its root **/
+  Instrumentation *m_instrumentation = NULL;
+#endif
+
+  /**
+   * @brief The handles of the elements, from the bottom up, with Removed
+   * in the places of the elements removed since the last compact()
+   */
+  std::vector<ElementId> m_order;
+
+  /** @brief The number of Removed places in m_order **/
+  size_t m_removed = 0;
+
+  /** @brief Whether any element overlaps another one **/
+  bool m_overlapping = false;
+
+  /** @brief Whether drawBeneath() draws any element **/
+  bool m_beneath = false;
+
+  /** @brief The handles of the elements spanning each row **/
+  std::vector<std::vector<ElementId>> m_buckets;
+
+  /** @brief The result of query() **/
+  std::vector<ElementId> m_found;
+
+  /** @brief The number of calls to query() **/
+  size_t m_visit = 0;
+
+  /** @brief The number of calls to repaint() **/
+  size_t m_repaints = 0;
+
+  /** @brief Scratch space for repaint(), as a heap by depth **/
+  std::vector<ElementId> m_queue;
+
+  /** @brief Whether any element is overdrawn **/
+  bool m_overdrawn = false;
+
+  /** @brief Scratch space for cull() **/
+  std::vector<size_t> m_uncovered;
+
+  /** @brief The elements cull() looks at **/
+  std::vector<ElementId> m_culling;
+
+  /** @brief Scratch space for covers() **/
+  std::vector<std::pair<int, int>> m_spans;
+
+  /** @brief Scratch space for repaint() **/
+  std::vector<Rect> m_repainted;
+};
+
+inline BoxLayout &BoxLayout::addBox(Direction direction, int gap,
+                                    const Constraints &constraints) {
+  BoxLayout *box = new BoxLayout(m_owner, this, direction, gap);
+  m_items.push_back(
+      Item{0, std::unique_ptr<BoxLayout>(box), constraints, 0});
+  invalidate();
+  return *box;
+}
+
+inline void BoxLayout::setConstraints(size_t index,
+                                      const Constraints &constraints) {
+  Constraints &current = item(index).constraints;
+  if (current.weight == constraints.weight && current.min == constraints.min &&
+      current.max == constraints.max) {
+    return;
+  }
+  current = constraints;
+  invalidate();
+}
+
+inline void BoxLayout::remove(size_t index) {
+  item(index);
+  m_items.erase(m_items.begin() + index);
+  invalidate();
+}
+
+inline int BoxLayout::minimum(Direction axis) {
+  if (!m_measured) {
+    for (Direction measured : {Horizontal, Vertical}) {
+      int total = 0;
+      for (auto &item : m_items) {
+        int min = minimum(item, measured);
+        total = measured == m_direction ? total + min : std::max(total, min);
+      }
+      if (measured == m_direction && !m_items.empty()) {
+        total += m_gap * static_cast<int>(m_items.size() - 1);
+      }
+      m_minimum[measured] = total;
+    }
+    m_measured = true;
+  }
+  return m_minimum[axis];
+}
+
+inline void BoxLayout::distribute(int space) {
+  int left = space;
+  for (auto &item : m_items) {
+    item.size = std::min(minimum(item, m_direction), item.constraints.max);
+    left -= item.size;
+  }
+  // Without enough space, the last items are the ones cut short.
+  for (auto i = m_items.rbegin(); left < 0 && i != m_items.rend(); ++i) {
+    int cut = std::min(i->size, -left);
+    i->size -= cut;
+    left += cut;
+  }
+
+  while (left > 0) {
+    unsigned long weights = 0;
+    for (auto &item : m_items) {
+      if (item.constraints.weight > 0 && item.size < item.constraints.max) {
+        weights += item.constraints.weight;
+      }
+    }
+    if (weights == 0) {
+      break;
+    }
+    int given = 0;
+    for (auto &item : m_items) {
+      if (item.constraints.weight == 0 || item.size >= item.constraints.max) {
+        continue;
+      }
+      long share = static_cast<long>(left) * item.constraints.weight / weights;
+      int grow = static_cast<int>(
+          std::min<long>(share, item.constraints.max - item.size));
+      item.size += grow;
+      given += grow;
+    }
+    if (given == 0) {
+      // The shares rounded down to nothing, so hand out single cells.
+      for (auto &item : m_items) {
+        if (given < left && item.constraints.weight > 0 &&
+            item.size < item.constraints.max) {
+          item.size++;
+          given++;
+        }
+      }
+    }
+    left -= given;
+  }
+}
+
+inline void BoxLayout::arrange(const Rect &rect, std::vector<Move> &moves) {
+  if (m_arranged && rect == m_rect) {
+    return;
+  }
+  m_rect = rect;
+  m_arranged = true;
+
+  bool horizontal = m_direction == Horizontal;
+  int space = horizontal ? rect.cols : rect.rows;
+  if (!m_items.empty()) {
+    space -= m_gap * static_cast<int>(m_items.size() - 1);
+  }
+  distribute(std::max(space, 0));
+
+  int offset = horizontal ? rect.x : rect.y;
+  for (auto &item : m_items) {
+    Rect bounds = horizontal ? Rect{offset, rect.y, rect.rows, item.size}
+                             : Rect{rect.x, offset, item.size, rect.cols};
+    offset += item.size + m_gap;
+    if (item.box) {
+      item.box->arrange(bounds, moves);
+      continue;
+    }
+    Window *window = static_cast<Window *>(&m_owner->get(item.window));
+    if (window->bounds() != bounds) {
+      moves.push_back(Move{window, window->bounds(), bounds});
+    }
+  }
+}
+
+inline void BoxLayout::invalidate() {
+  m_arranged = false;
+  m_measured = false;
+  if (m_parent) {
+    m_parent->invalidate();
+  } else {
+    m_owner->damage(Rect{0, 0, 0, 0});
+  }
+}
+
+/**
+ * @brief A window whose content can be larger than the region it occupies
+ *
+ * The content is drawn once into a pad, and scrollTo() only pans the
+ * visible part of it, which costs a copy rather than drawing the elements
+ * again. The elements are added as to a Window, relative to the content.
+ * Pads can't be nested in other pads.
+ */
+class PadWindow : public Window {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param rows The number of visible rows
+   * @param cols The number of visible cols
+   * @param contentRows The number of rows of the content
+   * @param contentCols The number of cols of the content
+   */
+  PadWindow(int x, int y, int rows, int cols, int contentRows, int contentCols)
+      : Window(x, y, contentRows, contentCols, false), m_viewRows(rows),
+        m_viewCols(cols) {}
+
+  /**
+   * @brief The number of visible rows
+   */
+  int rows() const { return m_viewRows; }
+
+  /**
+   * @brief The number of visible cols
+   */
+  int cols() const { return m_viewCols; }
+
+  /** @brief The first visible row of the content **/
+  int top() const { return m_top; }
+
+  /** @brief The first visible col of the content **/
+  int left() const { return m_left; }
+
+  /**
+   * @brief Pans the visible part of the content
+   *
+   * @param row The first row of the content to show.
+   * @param col The first col of the content to show.
+   */
+  void scrollTo(int row, int col) {
+    row = std::max(0, std::min(row, Window::rows() - m_viewRows));
+    col = std::max(0, std::min(col, Window::cols() - m_viewCols));
+    if (row == m_top && col == m_left) {
+      return;
+    }
+    m_top = row;
+    m_left = col;
+    expose(Rect{0, 0, m_viewRows, m_viewCols});
+    invalidate();
+  }
+
+  /**
+   * @copydoc Window::at()
+   *
+   * The cell is relative to the visible part of the pad.
+   */
+  Element *at(int x, int y) { return Window::at(x + m_left, y + m_top); }
+
+  void draw(WINDOW *parent) {
+    if (!handle()) {
+      activate();
+      setHandle(newpad(Window::rows(), Window::cols()));
+      if (!handle()) {
+        throw CursesException("Could not create pad");
+      }
+    }
+    Window::draw(parent);
+  }
+
+protected:
+  /**
+   * @brief Copies the visible part of the pad to the virtual screen
+   *
+   * The containing window is staged first and may have overwritten the
+   * region of the pad, so all the visible rows are copied.
+   */
+  bool stage(bool refresh) {
+    Window::stage(false);
+    if (!handle() || !parent() || !parent()->handle()) {
+      return false;
+    }
+    int top, left, lines, cols;
+    getbegyx(parent()->handle(), top, left);
+    getmaxyx(stdscr, lines, cols);
+    top += y();
+    left += x();
+    int bottom = std::min(top + m_viewRows, lines) - 1;
+    int right = std::min(left + m_viewCols, cols) - 1;
+    if (bottom < top || right < left) {
+      return false;
+    }
+    wtouchln(handle(), m_top, m_viewRows, 1);
+    pnoutrefresh(handle(), m_top, m_left, top, left, bottom, right);
+    if (Instrumentation *instrumentation = this->instrumentation()) {
+      instrumentation->frame.cellsTouched += m_viewRows * m_viewCols;
+      instrumentation->frame.refreshes++;
+    }
+    (void)refresh;
+    return true;
+  }
+
+  /**
+   * @brief Propagates the damage in the visible part of the content
+   */
+  void damageParent(const Rect &rect) {
+    int first = std::max(rect.y, m_top);
+    int last = std::min(rect.y + rect.rows, m_top + m_viewRows);
+    if (first < last) {
+      parent()->damage(Rect{x(), y() + first - m_top, last - first, m_viewCols});
+    }
+  }
+
+  /**
+   * @brief Pads don't depend on the size of the terminal
+   */
+  void resized() {}
+
+  /**
+   * @brief Resizes the visible part of the pad, keeping the content
+   */
+  void setSize(int rows, int cols) {
+    m_viewRows = rows;
+    m_viewCols = cols;
+    m_top = std::max(0, std::min(m_top, Window::rows() - rows));
+    m_left = std::max(0, std::min(m_left, Window::cols() - cols));
+  }
+
+  bool overlays() const { return true; }
+
+private:
+  int m_viewRows;
+
+  int m_viewCols;
+
+  /** @brief The first visible row of the content **/
+  int m_top = 0;
+
+  /** @brief The first visible col of the content **/
+  int m_left = 0;
+};
+
+/**
+ * @brief A pool of top-level curses windows, recycled instead of deleted
+ */
+class WindowPool {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param capacity The number of released windows kept for reuse.
+   */
+  explicit WindowPool(size_t capacity = 8) : m_capacity(capacity) {}
+
+  WindowPool(const WindowPool &) = delete;
+  WindowPool &operator=(const WindowPool &) = delete;
+
+  ~WindowPool() {
+    for (WINDOW *window : m_windows) {
+      delwin(window);
+    }
+  }
+
+  /**
+   * @brief Gets a window, reusing a released one if possible
+   *
+   * A released window of the same size is preferred, then any released
+   * window, resized.
+   *
+   * @param rows The number of rows.
+   * @param cols The number of cols.
+   * @param y The row on the screen.
+   * @param x The col on the screen.
+   * @return The window, or NULL if it doesn't fit on the screen.
+   */
+  WINDOW *acquire(int rows, int cols, int y, int x) {
+    auto match = std::find_if(
+        m_windows.begin(), m_windows.end(), [&](WINDOW *window) {
+          return getmaxy(window) == rows && getmaxx(window) == cols;
+        });
+    if (match == m_windows.end() && !m_windows.empty()) {
+      match = m_windows.end() - 1;
+    }
+    if (match != m_windows.end()) {
+      WINDOW *window = *match;
+      m_windows.erase(match);
+      // A window that would be moved off the screen is shrunk first.
+      bool moved = mvwin(window, y, x) == OK ||
+                   (wresize(window, 1, 1) == OK && mvwin(window, y, x) == OK);
+      if (moved && wresize(window, rows, cols) == OK) {
+        return window;
+      }
+      delwin(window);
+    }
+    return newwin(rows, cols, y, x);
+  }
+
+  /**
+   * @brief Releases a window for reuse
+   *
+   * @param window The window, whose subwindows must all be deleted.
+   */
+  void release(WINDOW *window) {
+    if (!window) {
+      return;
+    }
+    if (m_windows.size() < m_capacity) {
+      m_windows.push_back(window);
+    } else {
+      delwin(window);
+    }
+  }
+
+private:
+  size_t m_capacity;
+
+  /** @brief The released windows **/
+  std::vector<WINDOW *> m_windows;
+};
+
+/**
+ * @brief A window shown above the rest of the screen
+ *
+ * Popups are opened and closed through Screen, and are stacked in the
+ * order they were opened. Each has its own curses window, taken from a
+ * pool of the screen, so the cells under it are never overwritten:
+ * closing it only copies those rows of the screen to the terminal again,
+ * instead of repainting the windows they belong to. Popups aren't part of
+ * Screen::frame(), and don't move; to move one, close it and open another,
+ * which reuses its curses window.
+ */
+class Popup : public Window {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate on the screen
+   * @param y The y coordinate on the screen
+   * @param rows The number of rows
+   * @param cols The number of cols
+   * @param border Whether to draw a border
+   * @param pool The pool to take the curses window from
+   */
+  Popup(int x, int y, int rows, int cols, bool border, WindowPool &pool)
+      : Window(x, y, rows, cols, border), m_pool(&pool) {}
+
+  virtual ~Popup() { detach(); }
+
+  void setBounds(const Rect &rect) = delete;
+
+  void draw(WINDOW *parent) {
+    if (!handle()) {
+      activate();
+      setHandle(m_pool->acquire(rows(), cols(), y(), x()));
+      if (!handle()) {
+        throw CursesException("Could not create popup");
+      }
+    }
+    Window::draw(parent);
+  }
+
+protected:
+  /**
+   * @brief Clears the damage of the popup
+   *
+   * The popup is copied to the virtual screen by Screen, once the rest of
+   * the screen is.
+   */
+  bool stage(bool refresh) {
+    Window::stage(false);
+    (void)refresh;
+    return false;
+  }
+
+  /**
+   * @brief Popups are placed on the screen, whatever its size
+   */
+  void resized() {}
+
+  bool overlays() const { return true; }
+
+  /**
+   * @brief Releases the curses window to the pool
+   */
+  void detach() {
+    WINDOW *window = handle();
+    setHandle(NULL);
+    Window::detach();
+    m_pool->release(window);
+  }
+
+  /**
+   * @brief Marks the screen as changed, but none of its rows
+   *
+   * The popup doesn't share its memory with the screen.
+   */
+  void damageParent(const Rect &rect) {
+    (void)rect;
+    parent()->damage(Rect{0, 0, 0, 0});
+  }
+
+private:
+  friend class Screen;
+
+  /**
+   * @brief Copies the popup to the virtual screen
+   *
+   * The screen may have overwritten the region of the popup, so all of it
+   * is copied.
+   */
+  void overlay() {
+    if (handle()) {
+      touchwin(handle());
+      wnoutrefresh(handle());
+      if (Instrumentation *instrumentation = this->instrumentation()) {
+        instrumentation->frame.cellsTouched += getmaxy(handle()) * getmaxx(handle());
+        instrumentation->frame.refreshes++;
+      }
+    }
+  }
+
+  WindowPool *m_pool;
+};
+
+inline size_t BoxLayout::add(ElementId window,
+                             const Constraints &constraints) {
+  Window *element = dynamic_cast<Window *>(&m_owner->get(window));
+  if (!element) {
+    throw CursesException("Only windows can be laid out");
+  }
+  if (dynamic_cast<Popup *>(element)) {
+    throw CursesException("Popups can't be laid out");
+  }
+  m_items.push_back(Item{window, NULL, constraints, 0});
+  invalidate();
+  return m_items.size() - 1;
+}
+
+inline void Element::applyStyle(WINDOW *window, const Style &style) {
+  ColorPairs *pairs = m_parent ? m_parent->colorPairs() : NULL;
+  short pair = pairs ? pairs->get(style.fg, style.bg) : 0;
+  applyAttributes(window, style.attrs, pair);
+}
+
+inline void Element::invalidate() {
+  if (m_parent) {
+    m_parent->damage(bounds(), *this);
+  }
+}
+
+inline void Text::setText(std::string_view text) {
+  bool ascii;
+  int width = displayWidth(text, ascii);
+  Window *window = parent();
+  if (window &&
+      !window->fits(Rect{x(), y(), rows(), width})) {
+    throw CursesException("Element doesn't fit in window");
+  }
+  if (!window || !window->handle()) {
+    m_text.assign(text.data(), text.size());
+    m_shared.reset();
+    m_width = width;
+    m_ascii = ascii;
+    widen();
+    return;
+  }
+
+  WINDOW *handle = window->handle();
+  applyStyle(handle, m_style);
+  const std::string &current = this->text();
+  int common = 0;
+  if (ascii && m_ascii) {
+    // Cells and bytes match, so only the differing cells are written.
+    common = std::min(m_width, width);
+    int i = 0;
+    while (i < common) {
+      if (current[i] == text[i]) {
+        i++;
+        continue;
+      }
+      int first = i;
+      while (i < common && current[i] != text[i]) {
+        i++;
+      }
+      mvwaddnstr(handle, y(), x() + first, text.data() + first, i - first);
+    }
+  }
+  int old = m_width;
+  m_text.assign(text.data(), text.size());
+  // The new text may be a view of the shared one, kept until the end.
+  std::shared_ptr<const std::string> shared = std::move(m_shared);
+  m_width = width;
+  m_ascii = ascii;
+  widen();
+  if (common == 0) {
+    put(handle);
+  } else if (width > common) {
+    mvwaddnstr(handle, y(), x() + common, text.data() + common,
+               width - common);
+  }
+  if (old > width) {
+    applyAttributes(handle, A_NORMAL, 0);
+    mvwhline(handle, y(), x() + width, ' ', old - width);
+  }
+  // The blanked tail may lie under elements stacked above the text.
+  window->damage(Rect{x(), y(), rows(), std::max(old, width)}, *this);
+}
+
+inline void Text::setStyle(const Style &style) {
+  if (style == m_style) {
+    return;
+  }
+  m_style = style;
+  if (parent() && parent()->handle()) {
+    draw(parent()->handle());
+    invalidate();
+  }
+}
+
+inline void Text::format(const char *format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0) {
+    throw CursesException("Invalid format");
+  }
+  if (static_cast<size_t>(length) < sizeof(buffer)) {
+    setText(std::string_view(buffer, length));
+    return;
+  }
+
+  std::string text(length, '\0');
+  va_start(args, format);
+  std::vsnprintf(&text[0], length + 1, format, args);
+  va_end(args);
+  setText(text);
+}
+
+inline bool TextView::poll() {
+  if (m_generation->load(std::memory_order_acquire) == m_drawn ||
+      !parent() || !parent()->handle()) {
+    return false;
+  }
+  draw(parent()->handle());
+  invalidate();
+  return true;
+}
+
+/**
+ * @brief A horizontal bar filled to a fraction
+ *
+ * A change of the fraction only writes the cells between the old and the
+ * new ends of the bar, which is usually a single one.
+ */
+class ProgressBar : public Element {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param cols The width of the bar
+   */
+  ProgressBar(int x, int y, int cols) : Element(x, y), m_cols(cols) {
+    if (cols <= 0) {
+      throw CursesException("A progress bar must be at least one col wide");
+    }
+  }
+
+  int rows() const { return 1; }
+
+  int cols() const { return m_cols; }
+
+  /** @brief The fraction the bar is filled to **/
+  double value() const { return m_value; }
+
+  /**
+   * @brief Fills the bar to a fraction
+   *
+   * @param fraction The fraction, clamped to [0, 1].
+   */
+  void setValue(double fraction);
+
+  /** @brief The style of the bar **/
+  const Style &style() const { return m_style; }
+
+  /**
+   * @brief Changes the style of the bar
+   *
+   * @param style The new style.
+   */
+  void setStyle(const Style &style);
+
+  void draw(WINDOW *parent) { paint(parent, 0, m_cols); }
+
+private:
+  /**
+   * @brief Writes some cells of the bar
+   *
+   * @param first The first col.
+   * @param last One past the last col.
+   */
+  void paint(WINDOW *window, int first, int last) {
+    applyStyle(window, m_style);
+    for (int col = first; col < last; col++) {
+      int eighths = std::max(0, std::min(m_eighths - col * 8, 8));
+      putMeterGlyph(window, y(), x() + col, eighths, false);
+    }
+  }
+
+  int m_cols;
+
+  double m_value = 0;
+
+  /** @brief The length of the bar, in eighths of a cell **/
+  int m_eighths = 0;
+
+  Style m_style;
+};
+
+/**
+ * @brief A vertical meter of a value within a range
+ *
+ * The meter fills from the bottom, and a change of the value only writes
+ * the rows between the old and the new levels.
+ */
+class Gauge : public Element {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param rows The height of the meter
+   * @param cols The width of the meter
+   * @param min The value of an empty meter
+   * @param max The value of a full meter
+   */
+  Gauge(int x, int y, int rows, int cols, double min, double max)
+      : Element(x, y), m_rows(rows), m_cols(cols), m_min(min), m_max(max),
+        m_value(min) {
+    if (rows <= 0 || cols <= 0) {
+      throw CursesException("A gauge must be at least one cell large");
+    }
+    if (!(max > min)) {
+      throw CursesException("The range of a gauge must not be empty");
+    }
+  }
+
+  int rows() const { return m_rows; }
+
+  int cols() const { return m_cols; }
+
+  /** @brief The value shown **/
+  double value() const { return m_value; }
+
+  /**
+   * @brief Shows a value
+   *
+   * @param value The value, clamped to the range of the gauge.
+   */
+  void setValue(double value);
+
+  /** @brief The style of the meter **/
+  const Style &style() const { return m_style; }
+
+  /**
+   * @brief Changes the style of the meter
+   *
+   * @param style The new style.
+   */
+  void setStyle(const Style &style);
+
+  void draw(WINDOW *parent) { paint(parent, 0, m_rows); }
+
+private:
+  /**
+   * @brief Writes some rows of the meter
+   *
+   * @param first The first row, from the top.
+   * @param last One past the last row.
+   */
+  void paint(WINDOW *window, int first, int last) {
+    applyStyle(window, m_style);
+    for (int row = first; row < last; row++) {
+      int eighths =
+          std::max(0, std::min(m_eighths - (m_rows - 1 - row) * 8, 8));
+      for (int col = 0; col < m_cols; col++) {
+        putMeterGlyph(window, y() + row, x() + col, eighths, true);
+      }
+    }
+  }
+
+  int m_rows;
+
+  int m_cols;
+
+  double m_min;
+
+  double m_max;
+
+  double m_value;
+
+  /** @brief The height of the meter, in eighths of a cell **/
+  int m_eighths = 0;
+
+  Style m_style;
+};
+
+/**
+ * @brief A single-line chart of the latest samples of a value
+ *
+ * The samples are kept in a ring buffer of one sample per col, the newest
+ * on the right. A new sample shifts the chart, which is written as a whole
+ * row of cells at once.
+ */
+class Sparkline : public Element {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param cols The width of the chart, and the number of samples kept
+   * @param min The value of an empty col
+   * @param max The value of a full col
+   */
+  Sparkline(int x, int y, int cols, double min, double max)
+      : Element(x, y), m_min(min), m_max(max), m_samples(cols, min),
+        m_row(cols) {
+    if (cols <= 0) {
+      throw CursesException("A sparkline must be at least one col wide");
+    }
+    if (!(max > min)) {
+      throw CursesException("The range of a sparkline must not be empty");
+    }
+  }
+
+  int rows() const { return 1; }
+
+  int cols() const { return m_samples.size(); }
+
+  /**
+   * @brief Adds a sample, dropping the oldest one
+   *
+   * @param sample The sample, clamped to the range of the chart.
+   */
+  void push(double sample);
+
+  /**
+   * @brief Gets a sample
+   *
+   * @param age The age of the sample, 0 being the newest.
+   */
+  double sample(int age) const {
+    int count = m_samples.size();
+    return m_samples[(m_oldest + count - 1 - age % count) % count];
+  }
+
+  /** @brief The style of the chart **/
+  const Style &style() const { return m_style; }
+
+  /**
+   * @brief Changes the style of the chart
+   *
+   * @param style The new style.
+   */
+  void setStyle(const Style &style);
+
+  /**
+   * @brief Writes the whole row of the chart
+   *
+   * The cells are built with the attributes of the style, and copied to
+   * the window with a single call.
+   */
+  void draw(WINDOW *parent) {
+    applyStyle(parent, m_style);
+    attr_t attrs;
+    short pair;
+    wattr_get(parent, &attrs, &pair, NULL);
+    int count = m_samples.size();
+    for (int col = 0; col < count; col++) {
+      double sample = m_samples[(m_oldest + col) % count];
+      int eighths = meterEighths((sample - m_min) / (m_max - m_min), 1);
+#ifdef SIMPLECURSES_WIDECHAR
+      wchar_t glyph[2] = {meterGlyph(eighths, true), L'\0'};
+      setcchar(&m_row[col], glyph, attrs, pair, NULL);
+#else
+      m_row[col] = static_cast<unsigned char>(meterGlyph(eighths, true)) |
+                   attrs | COLOR_PAIR(pair);
+#endif
+    }
+#ifdef SIMPLECURSES_WIDECHAR
+    mvwadd_wchnstr(parent, y(), x(), m_row.data(), count);
+#else
+    mvwaddchnstr(parent, y(), x(), m_row.data(), count);
+#endif
+  }
+
+private:
+  double m_min;
+
+  double m_max;
+
+  /** @brief The ring buffer of the samples **/
+  std::vector<double> m_samples;
+
+  /** @brief The index of the oldest sample **/
+  int m_oldest = 0;
+
+  /** @brief The cells of the row, built by draw() **/
+#ifdef SIMPLECURSES_WIDECHAR
+  std::vector<cchar_t> m_row;
+#else
+  std::vector<chtype> m_row;
+#endif
+
+  Style m_style;
+};
+
+template <typename T> bool NumberField<T>::poll() {
+  Window *window = parent();
+  if (!window || !window->handle()) {
+    return false;
+  }
+  T value = read();
+  if (value == m_value) {
+    return false;
+  }
+  m_value = value;
+  char cells[MaxCols];
+  format(value, cells);
+  WINDOW *handle = window->handle();
+  int first = m_cols;
+  int last = 0;
+  int i = 0;
+  while (i < m_cols) {
+    if (m_cells[i] == cells[i]) {
+      i++;
+      continue;
+    }
+    if (first == m_cols) {
+      applyStyle(handle, m_style);
+    }
+    int start = i;
+    while (i < m_cols && m_cells[i] != cells[i]) {
+      m_cells[i] = cells[i];
+      i++;
+    }
+    mvwaddnstr(handle, y(), x() + start, m_cells + start, i - start);
+    first = std::min(first, start);
+    last = i;
+  }
+  if (last > first) {
+    window->damage(Rect{x() + first, y(), 1, last - first}, *this);
+    return true;
+  }
+  return false;
+}
+
+template <typename T> void NumberField<T>::setStyle(const Style &style) {
+  if (style == m_style) {
+    return;
+  }
+  m_style = style;
+  if (parent() && parent()->handle()) {
+    draw(parent()->handle());
+    invalidate();
+  }
+}
+
+inline void ProgressBar::setValue(double fraction) {
+  m_value = std::max(0.0, std::min(fraction, 1.0));
+  int eighths = meterEighths(m_value, m_cols);
+  if (eighths == m_eighths) {
+    return;
+  }
+  // Only the cells between the two ends of the bar change.
+  int first = std::min(eighths, m_eighths) / 8;
+  int last = std::min((std::max(eighths, m_eighths) + 7) / 8, m_cols);
+  m_eighths = eighths;
+  if (parent() && parent()->handle()) {
+    paint(parent()->handle(), first, last);
+    parent()->damage(Rect{x() + first, y(), 1, last - first}, *this);
+  }
+}
+
+inline void ProgressBar::setStyle(const Style &style) {
+  if (style == m_style) {
+    return;
+  }
+  m_style = style;
+  if (parent() && parent()->handle()) {
+    draw(parent()->handle());
+    invalidate();
+  }
+}
+
+inline void Gauge::setValue(double value) {
+  m_value = std::max(m_min, std::min(value, m_max));
+  int eighths = meterEighths((m_value - m_min) / (m_max - m_min), m_rows);
+  if (eighths == m_eighths) {
+    return;
+  }
+  // Only the rows between the two levels change, counted from the bottom.
+  int low = std::min(eighths, m_eighths) / 8;
+  int high = std::min((std::max(eighths, m_eighths) + 7) / 8, m_rows);
+  m_eighths = eighths;
+  if (parent() && parent()->handle()) {
+    paint(parent()->handle(), m_rows - high, m_rows - low);
+    parent()->damage(Rect{x(), y() + m_rows - high, high - low, m_cols},
+                     *this);
+  }
+}
+
+inline void Gauge::setStyle(const Style &style) {
+  if (style == m_style) {
+    return;
+  }
+  m_style = style;
+  if (parent() && parent()->handle()) {
+    draw(parent()->handle());
+    invalidate();
+  }
+}
+
+inline void Sparkline::push(double sample) {
+  m_samples[m_oldest] = std::max(m_min, std::min(sample, m_max));
+  m_oldest = (m_oldest + 1) % m_samples.size();
+  if (parent() && parent()->handle()) {
+    draw(parent()->handle());
+    invalidate();
+  }
+}
+
+inline void Sparkline::setStyle(const Style &style) {
+  if (style == m_style) {
+    return;
+  }
+  m_style = style;
+  if (parent() && parent()->handle()) {
+    draw(parent()->handle());
+    invalidate();
+  }
+}
+
+inline void TextView::setStyle(const Style &style) {
+  if (style == m_style) {
+    return;
+  }
+  m_style = style;
+  if (parent() && parent()->handle()) {
+    draw(parent()->handle());
+    invalidate();
+  }
+}
+
+/**
+ * @brief A window storing elements of known types by value
+ *
+ * The elements of each type are stored together and drawn in a loop that
+ * calls their draw() directly, without going through a pointer or a
+ * virtual call per element, which pays off for windows made of thousands
+ * of similar fields. They are drawn beneath the elements added as to any
+ * Window, get the same calls as those when the window is updated, moved or
+ * resized, and stay until the window is destroyed.
+ *
+ * @code
+ * auto &grid =
+ *     screen.emplace<TypedWindow<Text, NumberField<int>>>("grid", 0, 0, 20, 80,
+ *                                                         false);
+ * grid.add<Text>(0, 0, "Total");
+ * @endcode
+ *
+ * @tparam Elements The types of the elements stored by value, which must
+ * differ.
+ */
+template <typename... Elements> class TypedWindow : public Window {
+public:
+  static_assert((std::is_base_of<Element, Elements>::value && ...),
+                "Only elements can be stored in a window");
+
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param rows The number of rows
+   * @param cols The number of cols
+   * @param border Whether to draw a border
+   */
+  TypedWindow(int x, int y, int rows, int cols, bool border)
+      : Window(x, y, rows, cols, border) {}
+
+  using Window::add;
+
+  /**
+   * @brief Constructs an element stored by value
+   *
+   * @param args The arguments to the constructor of the element.
+   * @return The element, which stays at the same address.
+   */
+  template <typename WindowElement, typename... Args>
+  WindowElement &add(Args &&...args) {
+    static_assert((std::is_same<WindowElement, Elements>::value || ...),
+                  "The window doesn't store elements of this type");
+    std::deque<WindowElement> &list = elements<WindowElement>();
+    WindowElement &element = list.emplace_back(std::forward<Args>(args)...);
+    if (!fits(element.bounds())) {
+      list.pop_back();
+      throw CursesException("Element doesn't fit in window");
+    }
+    adopt(element);
+    if (handle()) {
+      element.WindowElement::draw(handle());
+      damage(element.bounds(), element);
+    }
+    return element;
+  }
+
+  /**
+   * @brief The elements of a type, in the order they were added
+   */
+  template <typename WindowElement> std::deque<WindowElement> &elements() {
+    return std::get<std::deque<WindowElement>>(m_elements);
+  }
+
+protected:
+  void drawBeneath(std::vector<Rect> *repainted) {
+    std::apply([&](auto &...lists) { (drawAll(lists, repainted), ...); },
+               m_elements);
+  }
+
+  void forBeneath(void (Element::*hook)()) {
+    std::apply(
+        [&](auto &...lists) {
+          auto run = [&](auto &list) {
+            for (Element &element : list) {
+              (element.*hook)();
+            }
+          };
+          (run(lists), ...);
+        },
+        m_elements);
+  }
+
+private:
+  /**
+   * @brief Draws the elements of a type
+   *
+   * @copydetails Window::drawBeneath()
+   */
+  template <typename WindowElement>
+  void drawAll(std::deque<WindowElement> &list, std::vector<Rect> *repainted) {
+    WINDOW *window = handle();
+    size_t drawn = 0;
+    if (!repainted) {
+      for (WindowElement &element : list) {
+        element.WindowElement::draw(window);
+      }
+      drawn = list.size();
+    } else {
+      for (WindowElement &element : list) {
+        Rect bounds = element.bounds();
+        if (std::any_of(repainted->begin(), repainted->end(),
+                        [&](const Rect &rect) {
+                          return rect.intersects(bounds);
+                        })) {
+          element.WindowElement::draw(window);
+          repainted->push_back(bounds);
+          drawn++;
+        }
+      }
+    }
+    if (Instrumentation *instrumentation = this->instrumentation()) {
+      instrumentation->frame.elementsDrawn += drawn;
+    }
+  }
+
+  std::tuple<std::deque<Elements>...> m_elements;
+};
+
+/**
+ * @brief The rows shown by a ListView
+ */
+class ListSource {
+public:
+  virtual ~ListSource() = default;
+
+  /** @brief The number of rows **/
+  virtual size_t rowCount() const = 0;
+
+  /**
+   * @brief Draws a row
+   *
+   * The line is blank and the cursor is at its start. The row must not be
+   * drawn past the end of the line, e.g. by using waddnstr() with the width
+   * of the window.
+   *
+   * @param index The index of the row.
+   * @param window The window of the list.
+   */
+  virtual void renderRow(size_t index, WINDOW *window) = 0;
+};
+
+/**
+ * @brief A scrolling list drawing only the rows it shows
+ *
+ * The rows are drawn on demand by a ListSource, so the memory and the cost
+ * of drawing the list only depend on the number of visible rows. Scrolling
+ * shifts the visible rows with wscrl() and only draws the rows it exposes.
+ */
+class ListView : public Element {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param rows The number of visible rows
+   * @param cols The number of cols
+   * @param source The rows, which must outlive the list.
+   */
+  ListView(int x, int y, int rows, int cols, ListSource &source)
+      : Element(x, y), m_rows(rows), m_cols(cols), m_source(source),
+        m_window(NULL) {}
+
+  virtual ~ListView() { delwin(m_window); }
+
+  /**
+   * @copydoc Element::rows()
+   */
+  int rows() const { return m_rows; }
+
+  /**
+   * @copydoc Element::cols()
+   */
+  int cols() const { return m_cols; }
+
+  /** @brief The index of the first visible row **/
+  size_t top() const { return m_top; }
+
+  void draw(WINDOW *parent) {
+    if (!m_window) {
+      m_window = derwin(parent, m_rows, m_cols, y(), x());
+      if (!m_window) {
+        return;
+      }
+    }
+    renderRows(0, m_rows);
+  }
+
+  /**
+   * @brief Scrolls the list
+   *
+   * @param top The index of the first row to show.
+   */
+  void scrollTo(size_t top) {
+    size_t count = m_source.rowCount();
+    size_t last = count > static_cast<size_t>(m_rows) ? count - m_rows : 0;
+    top = std::min(top, last);
+    if (top == m_top) {
+      return;
+    }
+    size_t distance = top > m_top ? top - m_top : m_top - top;
+    bool down = top > m_top;
+    m_top = top;
+    if (!m_window) {
+      return;
+    }
+
+    if (distance >= static_cast<size_t>(m_rows)) {
+      renderRows(0, m_rows);
+    } else if (down) {
+      shift(distance);
+      renderRows(m_rows - distance, m_rows);
+    } else {
+      shift(-static_cast<int>(distance));
+      renderRows(0, distance);
+    }
+    invalidate();
+  }
+
+  /**
+   * @brief Scrolls the list by a number of rows
+   *
+   * @param rows The number of rows, negative to scroll up.
+   */
+  void scrollBy(long rows) {
+    scrollTo(rows < 0 && static_cast<size_t>(-rows) > m_top ? 0
+                                                           : m_top + rows);
+  }
+
+  /**
+   * @brief Redraws a row after it changed, if it is visible
+   *
+   * @param index The index of the row.
+   */
+  void refreshRow(size_t index) {
+    if (!m_window || index < m_top || index >= m_top + m_rows) {
+      return;
+    }
+    int line = index - m_top;
+    renderRows(line, line + 1);
+    if (parent()) {
+      parent()->damage(Rect{x(), y() + line, 1, m_cols}, *this);
+    }
+  }
+
+  /**
+   * @brief Redraws the visible rows after the rows changed
+   */
+  void refresh() {
+    if (!m_window) {
+      return;
+    }
+    scrollTo(m_top);
+    renderRows(0, m_rows);
+    invalidate();
+  }
+
+protected:
+  /**
+   * @copydoc Element::detach()
+   */
+  void detach() {
+    delwin(m_window);
+    m_window = NULL;
+  }
+
+private:
+  /**
+   * @brief Scrolls the window
+   *
+   * Scrolling is only enabled meanwhile, so that drawing the bottom-right
+   * cell doesn't scroll the window.
+   */
+  void shift(int lines) {
+    scrollok(m_window, TRUE);
+    wscrl(m_window, lines);
+    scrollok(m_window, FALSE);
+  }
+
+  /**
+   * @brief Draws the rows shown on a range of lines
+   */
+  void renderRows(int first, int last) {
+    size_t count = m_source.rowCount();
+    for (int line = first; line < last; line++) {
+      wmove(m_window, line, 0);
+      wclrtoeol(m_window);
+      if (m_top + line < count) {
+        m_source.renderRow(m_top + line, m_window);
+      }
+    }
+  }
+
+  int m_rows;
+
+  int m_cols;
+
+  ListSource &m_source;
+
+  WINDOW *m_window;
+
+  /** @brief The index of the first visible row **/
+  size_t m_top = 0;
+};
+
+/**
+ * @brief A scrolling log of the most recent lines appended to it
+ *
+ * The lines are kept in a fixed-capacity ring buffer allocated upfront, so
+ * appending does not allocate. Drawing is deferred to the next update, so
+ * that all the lines appended since are drawn with a single scroll and a
+ * paint of the new tail.
+ */
+class LogView : public Element {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   * @param rows The number of visible rows
+   * @param cols The number of cols, beyond which lines are truncated
+   * @param capacity The number of lines kept, at least rows
+   */
+  LogView(int x, int y, int rows, int cols, size_t capacity = 0)
+      : Element(x, y), m_rows(rows), m_cols(cols),
+        m_capacity(std::max<size_t>(capacity, rows)),
+        m_buffer(m_capacity * cols), m_lengths(m_capacity), m_window(NULL) {}
+
+  virtual ~LogView() { delwin(m_window); }
+
+  /**
+   * @copydoc Element::rows()
+   */
+  int rows() const { return m_rows; }
+
+  /**
+   * @copydoc Element::cols()
+   */
+  int cols() const { return m_cols; }
+
+  /** @brief The number of lines kept **/
+  size_t size() const { return m_count; }
+
+  /**
+   * @brief Gets a line kept by the log
+   *
+   * @param index The index of the line, from the oldest one.
+   */
+  std::string_view line(size_t index) const {
+    size_t slot = (m_head + index) % m_capacity;
+    return std::string_view(&m_buffer[slot * m_cols], m_lengths[slot]);
+  }
+
+  /**
+   * @brief Appends a line to the log, dropping the oldest if full
+   *
+   * @param line The line, truncated to the width of the log.
+   */
+  void append(std::string_view line) {
+    size_t slot = (m_head + m_count) % m_capacity;
+    size_t length = std::min(line.size(), static_cast<size_t>(m_cols));
+    std::copy_n(line.data(), length, &m_buffer[slot * m_cols]);
+    m_lengths[slot] = length;
+    if (m_count < m_capacity) {
+      m_count++;
+    } else {
+      m_head = (m_head + 1) % m_capacity;
+    }
+
+    // Only the first append since the last update needs to damage the log.
+    if (m_pending++ == 0) {
+      invalidate();
+    }
+  }
+
+  /**
+   * @brief Removes all the lines
+   */
+  void clear() {
+    m_head = 0;
+    m_count = 0;
+    m_pending = m_rows;
+    invalidate();
+  }
+
+  void draw(WINDOW *parent) {
+    if (!m_window) {
+      m_window = derwin(parent, m_rows, m_cols, y(), x());
+      if (!m_window) {
+        return;
+      }
+    }
+    m_pending = 0;
+    renderLines(0);
+  }
+
+protected:
+  /**
+   * @copydoc Element::prepare()
+   */
+  void prepare() {
+    if (!m_window || m_pending == 0) {
+      return;
+    }
+    if (m_pending >= static_cast<size_t>(m_rows)) {
+      renderLines(0);
+    } else {
+      scrollok(m_window, TRUE);
+      wscrl(m_window, m_pending);
+      scrollok(m_window, FALSE);
+      renderLines(m_rows - m_pending);
+    }
+    m_pending = 0;
+  }
+
+  /**
+   * @copydoc Element::detach()
+   */
+  void detach() {
+    delwin(m_window);
+    m_window = NULL;
+  }
+
+private:
+  /**
+   * @brief Draws the most recent lines from a line of the window down
+   */
+  void renderLines(int first) {
+    // The most recent line is at the bottom.
+    size_t shown = std::min(m_count, static_cast<size_t>(m_rows));
+    size_t blank = m_rows - shown;
+    for (int row = first; row < m_rows; row++) {
+      wmove(m_window, row, 0);
+      wclrtoeol(m_window);
+      if (static_cast<size_t>(row) >= blank) {
+        std::string_view text = line(m_count - shown + (row - blank));
+        waddnstr(m_window, text.data(), text.size());
+      }
+    }
+  }
+
+  int m_rows;
+
+  int m_cols;
+
+  /** @brief The number of lines kept **/
+  size_t m_capacity;
+
+  /** @brief The lines, m_cols bytes each **/
+  std::vector<char> m_buffer;
+
+  /** @brief The lengths of the lines **/
+  std::vector<size_t> m_lengths;
+
+  /** @brief The slot of the oldest line **/
+  size_t m_head = 0;
+
+  /** @brief The number of lines kept so far **/
+  size_t m_count = 0;
+
+  /** @brief The lines appended since the last update **/
+  size_t m_pending = 0;
+
+  WINDOW *m_window;
+};
+
+/**
+ * @brief Layouts whose geometry is fixed at compile time
+ *
+ * The elements of a static layout are positioned by their types, so that
+ * the compiler checks that each of them fits in its container. They are
+ * stored by value in the layout, and drawn without virtual calls, name
+ * lookups or allocations. The layout as a whole is an Element, added to a
+ * window like any other:
+ *
+ * @code
+ * typedef Static::Layout<
+ *     5, 40,
+ *     Static::Box<0, 0, 5, 40, true,
+ *                 Static::Column<1, 0, Static::Label<0, 0, 20>,
+ *                                Static::Row<0, 1, Static::Label<0, 0, 10>,
+ *                                            Static::Label<2, 0, 10>>>>>
+ *     Dashboard;
+ *
+ * Dashboard &dashboard = screen.emplace<Dashboard>("dashboard", 0, 0);
+ * dashboard.get<0>().get<0>().get<0>().set("Status");
+ * @endcode
+ */
+namespace Static {
+
+/**
+ * @brief The offset of a child of a row or column along its axis
+ *
+ * @tparam Index The index of the child.
+ * @tparam Extents The extents of the children along the axis.
+ */
+template <size_t Index, int... Extents> constexpr int offset() {
+  const int extents[] = {0, Extents...};
+  int sum = 0;
+  for (size_t i = 1; i <= Index; i++) {
+    sum += extents[i];
+  }
+  return sum;
+}
+
+/**
+ * @brief Checks whether children fit in a region of a container
+ *
+ * @tparam Rows The number of rows of the region.
+ * @tparam Cols The number of cols of the region.
+ */
+template <int Rows, int Cols, typename... Children> constexpr bool fits() {
+  return ((Children::x >= 0 && Children::y >= 0 &&
+           Children::x + Children::cols <= Cols &&
+           Children::y + Children::rows <= Rows) &&
+          ...);
+}
+
+/**
+ * @brief Calls a function on each child of a container with its index
+ */
+template <typename Tuple, typename Function, size_t... Indices>
+void each(Tuple &children, Function function,
+          std::index_sequence<Indices...>) {
+  (function(std::get<Indices>(children),
+            std::integral_constant<size_t, Indices>()),
+   ...);
+}
+
+/**
+ * @brief The element holding a static layout in a window
+ *
+ * The elements of the layout draw through it into the window containing
+ * it.
+ */
+class Root : public Element {
+public:
+  Root(int x, int y) : Element(x, y) {}
+
+  Root(const Root &) = delete;
+  Root &operator=(const Root &) = delete;
+
+protected:
+  template <int, int, int> friend class Label;
+  template <int, int, int, int, bool, typename...> friend class Box;
+
+  /** @brief The curses window to draw in, if it exists yet **/
+  WINDOW *target() const { return parent() ? parent()->handle() : NULL; }
+
+  /**
+   * @brief Marks part of a row of the layout as changed
+   *
+   * @param x The first col, relative to the layout.
+   * @param y The row, relative to the layout.
+   * @param cols The number of cols.
+   */
+  void damage(int x, int y, int cols) {
+    if (parent()) {
+      parent()->damage(Rect{this->x() + x, this->y() + y, 1, cols}, *this);
+    }
+  }
+
+  /**
+   * @brief Sets the attributes of a window to draw with a style
+   *
+   * @copydetails Element::applyStyle()
+   */
+  void paint(WINDOW *window, const Style &style) {
+    applyStyle(window, style);
+  }
+};
+
+/**
+ * @brief A single-line text field of a fixed width
+ *
+ * The text is stored inline and truncated to the width of the field. Each
+ * byte takes up one col, so non-ASCII text belongs in a Text element.
+ *
+ * @tparam X The x coordinate relative to its container
+ * @tparam Y The y coordinate relative to its container
+ * @tparam Cols The width of the field
+ */
+template <int X, int Y, int Cols> class Label {
+public:
+  static_assert(Cols > 0, "A label must be at least one col wide");
+
+  static constexpr int x = X;
+  static constexpr int y = Y;
+  static constexpr int rows = 1;
+  static constexpr int cols = Cols;
+
+  /** @brief Gets the text of the field **/
+  std::string_view text() const { return std::string_view(m_text, m_length); }
+
+  /**
+   * @brief Changes the text of the field in place
+   *
+   * Only the cells that differ from the current text are written, and only
+   * the leftover tail is blanked when the new text is shorter.
+   *
+   * @param text The new text, truncated to the width of the field.
+   */
+  void set(std::string_view text) {
+    int length = static_cast<int>(std::min<size_t>(text.size(), Cols));
+    WINDOW *window = m_root ? m_root->target() : NULL;
+    if (window) {
+      m_root->paint(window, m_style);
+    }
+    int common = std::min(m_length, length);
+    int first = Cols;
+    int last = 0;
+    int i = 0;
+    while (i < common) {
+      if (m_text[i] == text[i]) {
+        i++;
+        continue;
+      }
+      int start = i;
+      while (i < common && m_text[i] != text[i]) {
+        m_text[i] = text[i];
+        i++;
+      }
+      if (window) {
+        mvwaddnstr(window, m_root->y() + m_y, m_root->x() + m_x + start,
+                   m_text + start, i - start);
+      }
+      first = std::min(first, start);
+      last = i;
+    }
+    if (length > common) {
+      std::copy(text.data() + common, text.data() + length, m_text + common);
+      if (window) {
+        mvwaddnstr(window, m_root->y() + m_y, m_root->x() + m_x + common,
+                   m_text + common, length - common);
+      }
+      first = std::min(first, common);
+      last = length;
+    } else if (m_length > common) {
+      if (window) {
+        applyAttributes(window, A_NORMAL, 0);
+        mvwhline(window, m_root->y() + m_y, m_root->x() + m_x + common, ' ',
+                 m_length - common);
+      }
+      first = std::min(first, common);
+      last = m_length;
+    }
+    m_length = length;
+    if (window && last > first) {
+      m_root->damage(m_x + first, m_y, last - first);
+    }
+  }
+
+  /**
+   * @brief Changes the text of the field from a printf-style format
+   *
+   * The text is formatted on the stack and truncated to the width of the
+   * field.
+   *
+   * @param format The format string.
+   */
+  void format(const char *format, ...) {
+    char buffer[Cols + 1];
+    va_list args;
+    va_start(args, format);
+    int length = std::vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0) {
+      throw CursesException("Invalid format");
+    }
+    set(std::string_view(buffer, std::min(length, Cols)));
+  }
+
+  /** @brief The style of the text **/
+  const Style &style() const { return m_style; }
+
+  /**
+   * @brief Changes the style of the text
+   *
+   * @param style The new style.
+   */
+  void setStyle(const Style &style) {
+    if (style == m_style) {
+      return;
+    }
+    m_style = style;
+    WINDOW *window = m_root ? m_root->target() : NULL;
+    if (window && m_length > 0) {
+      m_root->paint(window, m_style);
+      mvwaddnstr(window, m_root->y() + m_y, m_root->x() + m_x, m_text,
+                 m_length);
+      m_root->damage(m_x, m_y, m_length);
+    }
+  }
+
+  /**
+   * @brief Attaches the field to its layout
+   *
+   * @param root The layout.
+   * @param x The x coordinate of its container, relative to the layout.
+   * @param y The y coordinate of its container, relative to the layout.
+   */
+  void bind(Root *root, int x, int y) {
+    m_root = root;
+    m_x = x + X;
+    m_y = y + Y;
+  }
+
+  /**
+   * @brief Draws the field
+   *
+   * @param window The window containing the layout.
+   */
+  void draw(WINDOW *window) {
+    if (m_length > 0) {
+      m_root->paint(window, m_style);
+      mvwaddnstr(window, m_root->y() + m_y, m_root->x() + m_x, m_text,
+                 m_length);
+    }
+  }
+
+private:
+  Root *m_root = NULL;
+
+  /** @brief The x coordinate relative to the layout **/
+  int m_x = 0;
+
+  /** @brief The y coordinate relative to the layout **/
+  int m_y = 0;
+
+  int m_length = 0;
+  char m_text[Cols];
+  Style m_style;
+};
+
+/**
+ * @brief A fixed region of a layout, optionally bordered
+ *
+ * The children are positioned relative to the inside of the border, and
+ * must fit in it.
+ *
+ * @tparam X The x coordinate relative to its container
+ * @tparam Y The y coordinate relative to its container
+ * @tparam Rows The number of rows, including the border
+ * @tparam Cols The number of cols, including the border
+ * @tparam Border Whether to draw a border around the region
+ */
+template <int X, int Y, int Rows, int Cols, bool Border, typename... Children>
+class Box {
+public:
+  static constexpr int x = X;
+  static constexpr int y = Y;
+  static constexpr int rows = Rows;
+  static constexpr int cols = Cols;
+
+  static_assert(!Border || (Rows >= 2 && Cols >= 2),
+                "A bordered box needs room for its border");
+  static_assert(fits<Rows - 2 * Border, Cols - 2 * Border, Children...>(),
+                "Element doesn't fit in box");
+
+  /** @brief Gets a child of the box by index **/
+  template <size_t Index> auto &get() { return std::get<Index>(m_children); }
+
+  /** @copydoc Label::bind() **/
+  void bind(Root *root, int x, int y) {
+    m_root = root;
+    m_x = x + X;
+    m_y = y + Y;
+    each(m_children, [&](auto &child, auto) {
+      child.bind(root, m_x + Border, m_y + Border);
+    }, std::index_sequence_for<Children...>());
+  }
+
+  /**
+   * @brief Draws the box and its children
+   *
+   * @param window The window containing the layout.
+   */
+  void draw(WINDOW *window) {
+    if (Border) {
+      int top = m_root->y() + m_y;
+      int left = m_root->x() + m_x;
+      applyAttributes(window, A_NORMAL, 0);
+      mvwaddch(window, top, left, ACS_ULCORNER);
+      mvwhline(window, top, left + 1, ACS_HLINE, Cols - 2);
+      mvwaddch(window, top, left + Cols - 1, ACS_URCORNER);
+      mvwvline(window, top + 1, left, ACS_VLINE, Rows - 2);
+      mvwvline(window, top + 1, left + Cols - 1, ACS_VLINE, Rows - 2);
+      mvwaddch(window, top + Rows - 1, left, ACS_LLCORNER);
+      mvwhline(window, top + Rows - 1, left + 1, ACS_HLINE, Cols - 2);
+      mvwaddch(window, top + Rows - 1, left + Cols - 1, ACS_LRCORNER);
+    }
+    each(m_children, [&](auto &child, auto) { child.draw(window); },
+         std::index_sequence_for<Children...>());
+  }
+
+private:
+  std::tuple<Children...> m_children;
+  Root *m_root = NULL;
+  int m_x = 0;
+  int m_y = 0;
+};
+
+/**
+ * @brief Children laid out from left to right
+ *
+ * The x coordinate of each child is its gap from the previous one.
+ *
+ * @tparam X The x coordinate relative to its container
+ * @tparam Y The y coordinate relative to its container
+ */
+template <int X, int Y, typename... Children> class Row {
+public:
+  static constexpr int x = X;
+  static constexpr int y = Y;
+  static constexpr int rows = std::max({0, (Children::y + Children::rows)...});
+  static constexpr int cols = (0 + ... + (Children::x + Children::cols));
+
+  /** @brief Gets a child of the row by index **/
+  template <size_t Index> auto &get() { return std::get<Index>(m_children); }
+
+  /** @copydoc Label::bind() **/
+  void bind(Root *root, int x, int y) {
+    each(m_children, [&](auto &child, auto index) {
+      constexpr int offset =
+          Static::offset<decltype(index)::value,
+                         (Children::x + Children::cols)...>();
+      child.bind(root, x + X + offset, y + Y);
+    }, std::index_sequence_for<Children...>());
+  }
+
+  /** @copydoc Box::draw() **/
+  void draw(WINDOW *window) {
+    each(m_children, [&](auto &child, auto) { child.draw(window); },
+         std::index_sequence_for<Children...>());
+  }
+
+private:
+  std::tuple<Children...> m_children;
+};
+
+/**
+ * @brief Children laid out from top to bottom
+ *
+ * The y coordinate of each child is its gap from the previous one.
+ *
+ * @tparam X The x coordinate relative to its container
+ * @tparam Y The y coordinate relative to its container
+ */
+template <int X, int Y, typename... Children> class Column {
+public:
+  static constexpr int x = X;
+  static constexpr int y = Y;
+  static constexpr int rows = (0 + ... + (Children::y + Children::rows));
+  static constexpr int cols = std::max({0, (Children::x + Children::cols)...});
+
+  /** @brief Gets a child of the column by index **/
+  template <size_t Index> auto &get() { return std::get<Index>(m_children); }
+
+  /** @copydoc Label::bind() **/
+  void bind(Root *root, int x, int y) {
+    each(m_children, [&](auto &child, auto index) {
+      constexpr int offset =
+          Static::offset<decltype(index)::value,
+                         (Children::y + Children::rows)...>();
+      child.bind(root, x + X, y + Y + offset);
+    }, std::index_sequence_for<Children...>());
+  }
+
+  /** @copydoc Box::draw() **/
+  void draw(WINDOW *window) {
+    each(m_children, [&](auto &child, auto) { child.draw(window); },
+         std::index_sequence_for<Children...>());
+  }
+
+private:
+  std::tuple<Children...> m_children;
+};
+
+/**
+ * @brief A static layout, added to a window as a single element
+ *
+ * Only the size of the layout as a whole is checked when it is added to
+ * the window, since the one of the window is only known at runtime.
+ *
+ * @tparam Rows The number of rows of the layout
+ * @tparam Cols The number of cols of the layout
+ */
+template <int Rows, int Cols, typename... Children>
+class Layout : public Root {
+public:
+  static_assert(fits<Rows, Cols, Children...>(),
+                "Element doesn't fit in layout");
+
+  /**
+   * @brief Constructor
+   *
+   * @param x The x coordinate relative to its container
+   * @param y The y coordinate relative to its container
+   */
+  Layout(int x, int y) : Root(x, y) {
+    each(m_children, [&](auto &child, auto) { child.bind(this, 0, 0); },
+         std::index_sequence_for<Children...>());
+  }
+
+  /** @brief Gets a child of the layout by index **/
+  template <size_t Index> auto &get() { return std::get<Index>(m_children); }
+
+  /**
+   * @copydoc Element::rows()
+   */
+  int rows() const { return Rows; }
+
+  /**
+   * @copydoc Element::cols()
+   */
+  int cols() const { return Cols; }
+
+  void draw(WINDOW *parent) {
+    each(m_children, [&](auto &child, auto) { child.draw(parent); },
+         std::index_sequence_for<Children...>());
+  }
+
+private:
+  std::tuple<Children...> m_children;
+};
+
+} // namespace Static
+
+/**
+ * @brief A grid of cells, stored as a structure of arrays
+ *
+ * The characters, attributes and color pairs of the cells are kept in
+ * separate arrays of 32-bit values so rows can be compared many cells at a
+ * time.
+ */
+class CellBuffer {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param rows The number of rows
+   * @param cols The number of cols
+   */
+  CellBuffer(int rows = 0, int cols = 0) { resize(rows, cols); }
+
+  /** @brief The number of rows in the buffer **/
+  int rows() const { return m_rows; }
+
+  /** @brief The number of cols in the buffer **/
+  int cols() const { return m_cols; }
+
+  /**
+   * @brief Resizes the buffer
+   *
+   * The cells are reset to a value that never matches a curses cell, so
+   * they all compare as changed.
+   */
+  void resize(int rows, int cols) {
+    m_rows = rows;
+    m_cols = cols;
+    m_chars.assign(static_cast<size_t>(rows) * cols, UINT32_MAX);
+    m_attrs.assign(static_cast<size_t>(rows) * cols, UINT32_MAX);
+    m_colors.assign(static_cast<size_t>(rows) * cols, UINT32_MAX);
+  }
+
+  /**
+   * @brief Gets a cell as a curses character
+   *
+   * Only narrow characters fit in one; see character() for wide ones.
+   */
+  chtype get(int row, int col) const {
+    size_t i = index(row, col);
+    return m_chars[i] | m_attrs[i] | COLOR_PAIR(m_colors[i]);
+  }
+
+  /** @brief Gets the character of a cell, wide or not **/
+  uint32_t character(int row, int col) const {
+    return m_chars[index(row, col)];
+  }
+
+  /** @brief Sets a cell from a curses character **/
+  void set(int row, int col, chtype ch) {
+    size_t i = index(row, col);
+    m_chars[i] = ch & A_CHARTEXT;
+    m_attrs[i] = ch & (A_ATTRIBUTES & ~A_COLOR);
+    m_colors[i] = PAIR_NUMBER(ch);
+  }
+
+  /**
+   * @brief Reads a row from a curses window
+   *
+   * With SIMPLECURSES_WIDECHAR defined, the cells are read as wide
+   * characters, so that non-ASCII characters are kept whole; a cell with
+   * combining characters keeps a hash of all of them. Otherwise the cells
+   * are read as curses characters, which only hold a byte.
+   *
+   * @param window The window.
+   * @param row The row, in both the window and the buffer.
+   */
+  void capture(WINDOW *window, int row) {
+#ifdef SIMPLECURSES_WIDECHAR
+    m_line.resize(m_cols + 1);
+    bool read = mvwin_wchnstr(window, row, 0, m_line.data(), m_cols) == OK;
+    for (int col = 0; col < m_cols; col++) {
+      wchar_t wide[CCHARW_MAX + 1] = {L' ', L'\0'};
+      attr_t attrs = A_NORMAL;
+      short pair = 0;
+      if (read && getcchar(&m_line[col], wide, &attrs, &pair, NULL) == ERR) {
+        wide[0] = L' ';
+        wide[1] = L'\0';
+      }
+      uint32_t ch = wide[0];
+      if (wide[0] && wide[1]) {
+        // Combined cells never match a plain character.
+        for (int k = 1; k <= CCHARW_MAX && wide[k]; k++) {
+          ch = ch * 0x01000193 ^ static_cast<uint32_t>(wide[k]);
+        }
+        ch |= 0x80000000;
+      }
+      size_t i = index(row, col);
+      m_chars[i] = ch;
+      m_attrs[i] = attrs & (A_ATTRIBUTES & ~A_COLOR);
+      m_colors[i] = pair;
+    }
+#else
+    m_line.resize(m_cols + 1);
+    int count = mvwinchnstr(window, row, 0, m_line.data(), m_cols);
+    for (int col = 0; col < m_cols; col++) {
+      set(row, col, col < count ? m_line[col] : ' ');
+    }
+#endif
+  }
+
+  /**
+   * @brief The characters of a row, without their attributes
+   *
+   * Only the narrow characters are kept, which is what snapshots of the
+   * layout compare.
+   */
+  std::string text(int row) const {
+    std::string text(m_cols, ' ');
+    for (int col = 0; col < m_cols; col++) {
+      uint32_t ch = m_chars[index(row, col)];
+      if (ch < 0x100) {
+        text[col] = static_cast<char>(ch);
+      }
+    }
+    return text;
+  }
+
+  /**
+   * @brief Copies a row from another buffer of the same size
+   */
+  void copy(const CellBuffer &other, int row) {
+    size_t i = index(row, 0);
+    std::copy_n(&other.m_chars[i], m_cols, &m_chars[i]);
+    std::copy_n(&other.m_attrs[i], m_cols, &m_attrs[i]);
+    std::copy_n(&other.m_colors[i], m_cols, &m_colors[i]);
+  }
+
+  /**
+   * @brief Finds the span of a row that differs from another buffer
+   *
+   * @param other A buffer of the same size.
+   * @param row The row to compare.
+   * @return The first and one past the last differing cols, which are both
+   * cols() if the rows are equal.
+   */
+  std::pair<int, int> diff(const CellBuffer &other, int row) const {
+    size_t i = index(row, 0);
+    int first = std::min({mismatch(&m_chars[i], &other.m_chars[i], m_cols),
+                          mismatch(&m_attrs[i], &other.m_attrs[i], m_cols),
+                          mismatch(&m_colors[i], &other.m_colors[i], m_cols)});
+    if (first == m_cols) {
+      return std::make_pair(m_cols, m_cols);
+    }
+    int last = m_cols;
+    while (last > first && m_chars[i + last - 1] == other.m_chars[i + last - 1] &&
+           m_attrs[i + last - 1] == other.m_attrs[i + last - 1] &&
+           m_colors[i + last - 1] == other.m_colors[i + last - 1]) {
+      last--;
+    }
+    return std::make_pair(first, last);
+  }
+
+private:
+  size_t index(int row, int col) const {
+    return static_cast<size_t>(row) * m_cols + col;
+  }
+
+  /**
+   * @brief Finds the first index at which two arrays differ
+   *
+   * Compares 16 cells per iteration when SSE2 is available.
+   */
+  static int mismatch(const uint32_t *a, const uint32_t *b, int count) {
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16) {
+      __m128i eq = _mm_set1_epi32(-1);
+      for (int j = 0; j < 16; j += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i + j));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i + j));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi32(x, y));
+      }
+      if (_mm_movemask_epi8(eq) != 0xFFFF) {
+        break;
+      }
+    }
+#endif
+    for (; i < count; i++) {
+      if (a[i] != b[i]) {
+        return i;
+      }
+    }
+    return count;
+  }
+
+  int m_rows = 0;
+
+  int m_cols = 0;
+
+  std::vector<uint32_t> m_chars;
+
+  std::vector<uint32_t> m_attrs;
+
+  std::vector<uint32_t> m_colors;
+
+  /** @brief Scratch space for capture() **/
+#ifdef SIMPLECURSES_WIDECHAR
+  std::vector<cchar_t> m_line;
+#else
+  std::vector<chtype> m_line;
+#endif
+};
+
+/**
+ * @brief A lock-free queue with many producers and a single consumer
+ *
+ * Producers push onto an atomic list, and the consumer takes the whole list
+ * at once and replays it in the order it was pushed.
+ */
+template <typename T> class CommandQueue {
+public:
+  CommandQueue() = default;
+
+  CommandQueue(const CommandQueue &) = delete;
+
+  CommandQueue &operator=(const CommandQueue &) = delete;
+
+  ~CommandQueue() { destroy(m_head.load()); }
+
+  /**
+   * @brief Pushes a value, from any thread
+   *
+   * @param value The value.
+   */
+  void push(T value) {
+    Node *node = new Node{std::move(value), m_head.load(std::memory_order_relaxed)};
+    while (!m_head.compare_exchange_weak(node->next, node,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * @brief Pops every value pushed so far, from the consumer thread
+   *
+   * @param consume The function called with each value, in push order.
+   * @return Whether there was any value.
+   */
+  template <typename Consumer> bool drain(Consumer consume) {
+    Node *node = m_head.exchange(NULL, std::memory_order_acquire);
+    if (!node) {
+      return false;
+    }
+    Node *ordered = NULL;
+    while (node) {
+      Node *next = node->next;
+      node->next = ordered;
+      ordered = node;
+      node = next;
+    }
+    while (ordered) {
+      Node *next = ordered->next;
+      try {
+        consume(ordered->value);
+      } catch (...) {
+        destroy(ordered);
+        throw;
+      }
+      delete ordered;
+      ordered = next;
+    }
+    return true;
+  }
+
+private:
+  struct Node {
+    T value;
+    Node *next;
+  };
+
+  static void destroy(Node *node) {
+    while (node) {
+      Node *next = node->next;
+      delete node;
+      node = next;
+    }
+  }
+
+  /** @brief The last pushed node **/
+  std::atomic<Node *> m_head{NULL};
+};
+
+/**
+ * @brief A handle to a timer of a screen
+ */
+typedef std::size_t TimerId;
+
+/**
+ * @brief Where a screen is rendered
+ *
+ * The elements always draw to curses windows; a backend decides which
+ * terminal curses runs on and what happens to every frame it flushes. A
+ * backend must outlive the screen using it.
+ */
+class Backend {
+public:
+  virtual ~Backend() = default;
+
+  /**
+   * @brief Starts curses
+   *
+   * @return The standard screen.
+   */
+  virtual WINDOW *open() = 0;
+
+  /**
+   * @brief Ends curses
+   */
+  virtual void close() = 0;
+
+  /**
+   * @brief Reads the size of the terminal
+   *
+   * @return Whether the size is known.
+   */
+  virtual bool size(int &rows, int &cols) = 0;
+
+  /**
+   * @brief The file descriptor the keys are read from, or -1 for none
+   */
+  virtual int input() const = 0;
+
+  /**
+   * @brief Makes the terminal the current one of curses
+   */
+  virtual void activate() = 0;
+
+  /**
+   * @brief Called after every frame is flushed
+   */
+  virtual void presented() {}
+
+  /**
+   * @brief Whether SIGWINCH tells when the terminal is resized
+   *
+   * The signal only follows the controlling terminal of the process, so
+   * run() only listens to it for the backends drawing there.
+   */
+  virtual bool signalsResizes() const { return false; }
+};
+
+/**
+ * @brief Renders to a terminal connected to a pair of streams
+ *
+ * Every backend runs its own curses screen, created with newterm(), so a
+ * single process can drive many terminals, like the sessions of a server,
+ * from the same thread. Each Screen makes its terminal the current one of
+ * curses whenever it needs to; code calling curses directly on a screen
+ * should call Backend::activate() first.
+ */
+class TerminalBackend : public Backend {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param input The stream the keys are read from, which must stay open
+   * as long as the backend.
+   * @param output The stream the terminal is drawn to, which must stay
+   * open as long as the backend.
+   * @param type The terminal type, or NULL for the TERM environment
+   * variable.
+   */
+  TerminalBackend(FILE *input, FILE *output, const char *type = NULL)
+      : m_type(type ? type : ""), m_input(input), m_output(output),
+        m_owned(false) {}
+
+  /**
+   * @brief Constructor over file descriptors, like those of a socket
+   *
+   * @param input The descriptor the keys are read from, which is closed
+   * with the backend.
+   * @param output The descriptor the terminal is drawn to, which is closed
+   * with the backend.
+   * @param type The terminal type, or NULL for the TERM environment
+   * variable.
+   */
+  TerminalBackend(int input, int output, const char *type = NULL)
+      : m_type(type ? type : ""), m_input(fdopen(input, "r")),
+        m_output(fdopen(output, "w")), m_owned(true) {
+    if (!m_input || !m_output) {
+      if (m_input) {
+        fclose(m_input);
+      } else if (input != -1) {
+        ::close(input);
+      }
+      if (m_output) {
+        fclose(m_output);
+      } else if (output != -1) {
+        ::close(output);
+      }
+      throw CursesException("Could not open the terminal");
+    }
+  }
+
+  TerminalBackend(const TerminalBackend &) = delete;
+  TerminalBackend &operator=(const TerminalBackend &) = delete;
+
+  /**
+   * @brief Destructor
+   *
+   * The streams opened by the backend are closed at once. Unless curses is
+   * reentrant, though, its windows are listed globally and delscreen()
+   * deletes those of every terminal, so the terminal itself is only deleted
+   * once none is left open; until then, only its screen buffers are kept,
+   * shrunk to a single cell.
+   */
+  virtual ~TerminalBackend() {
+    if (m_screen) {
+#if NCURSES_REENTRANT
+      delscreen(m_screen);
+#else
+      set_term(m_screen);
+      wresize(curscr, 1, 1);
+      wresize(newscr, 1, 1);
+      if (s_current && s_current != m_screen) {
+        set_term(s_current);
+      }
+      s_open--;
+      s_closed.push_back(m_screen);
+      if (s_open == 0) {
+        for (SCREEN *screen : s_closed) {
+          delscreen(screen);
+        }
+        s_closed.clear();
+      }
+#endif
+      if (s_current == m_screen) {
+        s_current = NULL;
+      }
+    }
+    if (m_owned) {
+      fclose(m_input);
+      fclose(m_output);
+    }
+  }
+
+  WINDOW *open() {
+    if (m_screen) {
+      throw CursesException("The backend is already in use");
+    }
+    m_screen = newterm(m_type.empty() ? NULL : m_type.c_str(), m_output,
+                       m_input);
+    if (!m_screen) {
+      throw CursesException("Could not start curses on the terminal");
+    }
+    s_current = m_screen;
+    s_open++;
+    return stdscr;
+  }
+
+  void close() {
+    activate();
+    endwin();
+  }
+
+  bool size(int &rows, int &cols) {
+    struct winsize size;
+    if (ioctl(fileno(m_output), TIOCGWINSZ, &size) != 0) {
+      return false;
+    }
+    rows = size.ws_row;
+    cols = size.ws_col;
+    return true;
+  }
+
+  int input() const { return fileno(m_input); }
+
+  bool signalsResizes() const { return tcgetsid(fileno(m_output)) != -1; }
+
+  /**
+   * @brief Makes the terminal the current one of curses
+   *
+   * Switching is skipped when the terminal already is the current one.
+   */
+  void activate() {
+    if (m_screen && s_current != m_screen) {
+      set_term(m_screen);
+      s_current = m_screen;
+    }
+  }
+
+private:
+  /** @brief The terminal made current last by a backend **/
+  static inline SCREEN *s_current = NULL;
+
+  /** @brief The number of terminals opened and not yet closed **/
+  static inline size_t s_open = 0;
+
+  /** @brief The closed terminals, deleted once none is open **/
+  static inline std::vector<SCREEN *> s_closed;
+
+  /** @brief The terminal type, empty for the TERM environment variable **/
+  std::string m_type;
+
+  FILE *m_input;
+
+  FILE *m_output;
+
+  /** @brief Whether the streams were opened by the backend **/
+  bool m_owned;
+
+  /** @brief The curses screen, once opened **/
+  SCREEN *m_screen = NULL;
+};
+
+/**
+ * @brief Renders to the terminal of the process
+ */
+class CursesBackend : public TerminalBackend {
+public:
+  CursesBackend() : TerminalBackend(stdin, stdout) {}
+
+  WINDOW *open() {
+    WINDOW *window = TerminalBackend::open();
+    def_prog_mode();
+    return window;
+  }
+};
+
+/**
+ * @brief Renders to a grid of cells in memory
+ *
+ * Curses runs on a terminal whose output is discarded, and the cells it
+ * would show are copied to a buffer after every frame, pads and popups
+ * included, so that the same tree of elements can be rendered without a
+ * tty and its frames snapshotted or compared:
+ *
+ * @code
+ * MemoryBackend backend(24, 80);
+ * Screen screen(backend);
+ * screen.emplace<Text>("title", 0, 0, "Hello");
+ * screen.commit();
+ * assert(backend.cells().text(0).compare(0, 5, "Hello") == 0);
+ * @endcode
+ */
+class MemoryBackend : public TerminalBackend {
+public:
+  /**
+   * @brief Constructor
+   *
+   * @param rows The number of rows of the terminal
+   * @param cols The number of cols of the terminal
+   * @param type The terminal type curses emulates, which only changes
+   * which attributes and colors are available.
+   */
+  MemoryBackend(int rows, int cols, const char *type = "xterm-256color")
+      : TerminalBackend(::open("/dev/null", O_RDONLY | O_CLOEXEC),
+                        ::open("/dev/null", O_WRONLY | O_CLOEXEC), type),
+        m_rows(rows), m_cols(cols) {}
+
+  WINDOW *open() {
+    // The size is passed to newterm() through the environment: unless curses
+    // is reentrant, resizeterm() resizes the windows of every terminal.
+    const char *names[] = {"LINES", "COLUMNS"};
+    int values[] = {m_rows, m_cols};
+    std::string saved[2];
+    bool set[2];
+    for (int i = 0; i < 2; i++) {
+      const char *value = getenv(names[i]);
+      set[i] = value != NULL;
+      saved[i] = value ? value : "";
+      setenv(names[i], std::to_string(values[i]).c_str(), 1);
+    }
+    auto restore = [&]() {
+      for (int i = 0; i < 2; i++) {
+        if (set[i]) {
+          setenv(names[i], saved[i].c_str(), 1);
+        } else {
+          unsetenv(names[i]);
+        }
+      }
+    };
+    WINDOW *window;
+    try {
+      window = TerminalBackend::open();
+    } catch (...) {
+      restore();
+      throw;
+    }
+    restore();
+    m_cells.resize(m_rows, m_cols);
+    return window;
+  }
+
+  bool size(int &, int &) { return false; }
+
+  int input() const { return -1; }
+
+  /**
+   * @brief Copies the cells curses shows to the buffer
+   */
+  void presented() {
+    int rows, cols;
+    getmaxyx(curscr, rows, cols);
+    if (rows != m_cells.rows() || cols != m_cells.cols()) {
+      m_cells.resize(rows, cols);
+    }
+    for (int row = 0; row < rows; row++) {
+      m_cells.capture(curscr, row);
+    }
+  }
+
+  /**
+   * @brief The cells of the last frame flushed
+   */
+  const CellBuffer &cells() const { return m_cells; }
+
+private:
+  int m_rows;
+
+  int m_cols;
+
+  /** @brief The cells of the last frame flushed **/
+  CellBuffer m_cells;
+};
+
+/**
+ * @brief Represents a curses screen
+ */
+class Screen : public Window {
+public:
+  /**
+   * @brief Constructor, rendering to the terminal of the process
+   */
+  Screen() : Screen(std::make_unique<CursesBackend>()) {}
+
+  /**
+   * @brief Constructor
+   *
+   * @param backend Where to render, which must outlive the screen.
+   */
+  explicit Screen(Backend &backend)
+      : Window(0, 0, backend.open()), m_backend(&backend) {
+    start();
+  }
+
+  virtual ~Screen() {
+    // The popups release their curses windows to m_popupWindows.
+    while (!m_popups.empty()) {
+      closePopup(static_cast<Popup &>(get(m_popups.back())));
+    }
+    if (Screen *host = m_host) {
+      host->unserve(*this);
+    }
+    for (Screen *screen : m_served) {
+      if (screen) {
+        screen->m_host = NULL;
+      }
+    }
+    if (m_resizeFds[0] != -1) {
+      for (ResizeTarget *target = s_resizeTargets; target;
+           target = target->next) {
+        int registered = m_resizeFds[1];
+        target->fd.compare_exchange_strong(registered, -1);
+      }
+      close(m_resizeFds[0]);
+      close(m_resizeFds[1]);
+    }
+    for (int fd : m_wakeFds) {
+      close(fd);
+    }
+#ifdef SIMPLECURSES_STATS
+    if (m_ioFd != -1) {
+      close(m_ioFd);
+    }
+#endif
+    if (m_keys) {
+      delwin(m_keys);
+    }
+    m_backend->close();
+    destroy();
+  }
+
+  /**
+   * @brief Commits a frame
+   *
+   * Stages every damaged window in the tree and flushes them to the
+   * terminal at once with a single doupdate(), so nested windows no longer
+   * need to be updated one by one.
+   */
+  void commit() {
+    m_backend->activate();
+#ifdef SIMPLECURSES_STATS
+    auto start = std::chrono::steady_clock::now();
+    compose();
+    FrameStats &frame = m_instrumentation.frame;
+    frame.commitTime = std::chrono::steady_clock::now() - start;
+    if (m_instrumentation.trace) {
+      m_instrumentation.trace(
+          TraceEvent{"commit", NULL, NULL, start, frame.commitTime});
+    }
+    m_lastFrame = frame;
+    m_totalStats += frame;
+    frame = FrameStats();
+#else
+    compose();
+#endif
+  }
+
+#ifdef SIMPLECURSES_STATS
+  /** @brief What the last commit() cost **/
+  const FrameStats &lastFrame() const { return m_lastFrame; }
+
+  /** @brief What all the commits so far cost **/
+  const FrameStats &totalStats() const { return m_totalStats; }
+
+  /**
+   * @brief Sets a callback run for every traced step of rendering
+   *
+   * Every call of Element::draw() is traced, along with every commit() and
+   * doupdate(), so the callback should be cheap.
+   *
+   * @param callback The callback, like a ChromeTrace.
+   */
+  void onTrace(std::function<void(const TraceEvent &)> callback) {
+    m_instrumentation.trace = std::move(callback);
+  }
+#endif
+
+  /**
+   * @brief Enables or disables compositing
+   *
+   * When compositing, commit() compares the damaged rows with the last
+   * committed frame and only hands curses the rows that really changed,
+   * skipping the refresh entirely when none did.
+   *
+   * @param enabled Whether to composite.
+   */
+  void setCompositing(bool enabled) {
+    m_compositing = enabled;
+    if (enabled) {
+      int lines, cols;
+      getmaxyx(handle(), lines, cols);
+      m_front.resize(lines, cols);
+      m_back.resize(lines, cols);
+      m_exposed.assign(lines, false);
+      damage(Rect{0, 0, lines, cols});
+    }
+  }
+
+  /**
+   * @copydoc Window::colorPairs()
+   */
+  ColorPairs *colorPairs() {
+    m_backend->activate();
+    return &m_colorPairs;
+  }
+
+  /**
+   * @brief The last frame committed while compositing
+   */
+  const CellBuffer &frame() const { return m_front; }
+
+  /**
+   * @brief Opens a popup above the rest of the screen
+   *
+   * The curses window of a closed popup is reused when possible, and
+   * nothing under the popup is repainted.
+   *
+   * @param x The x coordinate on the screen
+   * @param y The y coordinate on the screen
+   * @param rows The number of rows
+   * @param cols The number of cols
+   * @param border Whether to draw a border
+   * @return The popup, valid until it is closed.
+   */
+  Popup &openPopup(int x, int y, int rows, int cols, bool border = true) {
+    ElementId id =
+        construct<Popup>(x, y, rows, cols, border, m_popupWindows);
+    m_popups.push_back(id);
+    return static_cast<Popup &>(get(id));
+  }
+
+  /**
+   * @brief Closes a popup
+   *
+   * Only the rows of the screen under the popup are copied to the terminal
+   * again.
+   *
+   * @param popup The popup.
+   */
+  void closePopup(Popup &popup) {
+    auto match = std::find_if(m_popups.begin(), m_popups.end(),
+                              [&](ElementId id) { return &get(id) == &popup; });
+    if (match == m_popups.end()) {
+      throw CursesException("No such popup");
+    }
+    ElementId id = *match;
+    m_popups.erase(match);
+    Rect rect = popup.bounds();
+    discard(id);
+    expose(rect);
+    damage(rect);
+  }
+
+  /**
+   * @brief Resizes the screen
+   *
+   * run() follows the resizes of the terminal by itself; this is for
+   * backends that have no terminal to follow. Unless curses is reentrant,
+   * like ncursest, it keeps a single list of the windows of every terminal
+   * and resizes them all, so screens sharing a process should then all be
+   * the same size.
+   *
+   * @param rows The number of rows
+   * @param cols The number of cols
+   */
+  void resize(int rows, int cols) {
+    m_backend->activate();
+    resizeterm(rows, cols);
+    resized();
+    if (m_compositing) {
+      setCompositing(true);
+    }
+    damage(Rect{0, 0, rows, cols});
+    if (m_resizeCallback) {
+      m_resizeCallback(*this);
+    }
+  }
+
+  /**
+   * @brief Caps the rate at which run() commits frames
+   *
+   * @param fps The maximum number of frames per second.
+   */
+  void setMaxFps(unsigned fps) {
+    if (fps == 0) {
+      throw CursesException("The frame rate must be positive");
+    }
+    m_frameInterval = std::chrono::nanoseconds(std::chrono::seconds(1)) / fps;
+  }
+
+  /**
+   * @brief Sets a callback run at the start of every frame of run()
+   *
+   * @param callback The callback.
+   */
+  void onFrame(std::function<void(Screen &)> callback) {
+    m_frameCallback = std::move(callback);
+  }
+
+  /**
+   * @brief Posts a command to be run by the render thread
+   *
+   * This and stop() are the only members safe to call from other threads. The
+   * posted commands are run in order by dispatch(), which run() calls at
+   * the start of every frame, so they are all part of a single commit.
+   *
+   * @code
+   * screen.post([&](Screen &) { price.setText(value); });
+   * @endcode
+   *
+   * @param command The command.
+   */
+  void post(std::function<void(Screen &)> command) {
+    m_commands.push(std::move(command));
+    wake();
+  }
+
+  /**
+   * @brief Runs the commands posted since the last dispatch
+   *
+   * @return Whether any command was run.
+   */
+  bool dispatch() {
+    return m_commands.drain(
+        [this](std::function<void(Screen &)> &command) { command(*this); });
+  }
+
+  /**
+   * @brief Sets the callback run for every key read by run()
+   *
+   * Setting it makes run() read the keyboard, in cbreak mode, without echo
+   * and with the function keys decoded.
+   *
+   * @param callback The callback, called with the key as returned by
+   * wgetch().
+   */
+  void onKey(std::function<void(Screen &, int)> callback) {
+    m_keyCallback = std::move(callback);
+    if (m_keyCallback) {
+      readKeys();
+    }
+  }
+
+  /**
+   * @brief Sets the callback run for every mouse event read by run()
+   *
+   * Setting it makes run() read the keyboard as with onKey(), and report
+   * the mouse events of the terminal. Keys other than KEY_MOUSE still go
+   * to the key callback.
+   *
+   * @param callback The callback, called with the event and the innermost
+   * element under the pointer, as found by at(), or NULL.
+   */
+  void onMouse(
+      std::function<void(Screen &, const MEVENT &, Element *)> callback) {
+    m_mouseCallback = std::move(callback);
+    if (m_mouseCallback) {
+      readKeys();
+      mousemask(ALL_MOUSE_EVENTS, NULL);
+    }
+  }
+
+  /**
+   * @brief Sets the callback run by run() after the terminal is resized
+   *
+   * @param callback The callback.
+   */
+  void onResize(std::function<void(Screen &)> callback) {
+    m_resizeCallback = std::move(callback);
+  }
+
+  /**
+   * @brief Adds a timer to run()
+   *
+   * @param interval The time after which the timer fires.
+   * @param callback The callback run when the timer fires.
+   * @param repeat Whether the timer fires again every interval.
+   * @return The handle of the timer.
+   */
+  TimerId addTimer(std::chrono::milliseconds interval,
+                   std::function<void(Screen &)> callback,
+                   bool repeat = false) {
+    TimerId id = m_nextTimerId++;
+    m_timers.push_back(Timer{id, std::chrono::steady_clock::now() + interval,
+                             interval, repeat, std::move(callback)});
+    return id;
+  }
+
+  /**
+   * @brief Removes a timer from run()
+   *
+   * @param id The handle of the timer.
+   */
+  void cancelTimer(TimerId id) {
+    for (auto &timer : m_timers) {
+      if (timer.id == id) {
+        timer.callback = NULL;
+      }
+    }
+  }
+
+  /**
+   * @brief Watches a file descriptor in run()
+   *
+   * @param fd The file descriptor.
+   * @param events The poll() events to watch for.
+   * @param callback The callback, called with the events that occurred.
+   */
+  void watch(int fd, short events,
+             std::function<void(Screen &, short)> callback) {
+    unwatch(fd);
+    m_watches.push_back(Watch{fd, events, std::move(callback)});
+  }
+
+  /**
+   * @brief Stops watching a file descriptor in run()
+   *
+   * @param fd The file descriptor.
+   */
+  void unwatch(int fd) {
+    for (auto &watch : m_watches) {
+      if (watch.fd == fd) {
+        watch.callback = NULL;
+      }
+    }
+  }
+
+  /**
+   * @brief Runs the events of another screen in run()
+   *
+   * The keys, resizes, posted commands, timers, watches and frames of the
+   * screen are then handled by the event loop of this one, so that a
+   * single thread can serve several terminals:
+   *
+   * @code
+   * Screen local;
+   * Screen remote(backend);
+   * local.serve(remote);
+   * local.run();
+   * @endcode
+   *
+   * A screen destroyed while served stops being run.
+   *
+   * @param screen The screen, which must not be running its own loop.
+   */
+  void serve(Screen &screen) {
+    if (&screen == this || screen.m_host == this) {
+      return;
+    }
+    if (Screen *host = screen.m_host) {
+      host->unserve(screen);
+    }
+    screen.m_host = this;
+    m_served.push_back(&screen);
+    wake();
+  }
+
+  /**
+   * @brief Stops running the events of another screen in run()
+   *
+   * @param screen The screen, served with serve().
+   */
+  void unserve(Screen &screen) {
+    for (auto &served : m_served) {
+      if (served == &screen) {
+        served = NULL;
+        screen.m_host = NULL;
+      }
+    }
+  }
+
+  /**
+   * @brief Runs the event loop until stop() is called
+   *
+   * A single poll() waits for keys, terminal resizes, posted commands,
+   * timers and the watched file descriptors, as well as for the next frame
+   * when there is damage to commit, of this screen and of those it serves.
+   * Changes to the elements only damage them, so any number of changes
+   * between two frames are coalesced into a single commit(), at most once
+   * per frame interval. When there is no damage, no frame callback and no
+   * timer, the loop sleeps until an event arrives.
+   */
+  void run() {
+    m_running = true;
+    m_nextFrame = std::chrono::steady_clock::now();
+    for (Screen *screen : m_served) {
+      if (screen) {
+        screen->m_nextFrame = m_nextFrame;
+      }
+    }
+    while (m_running) {
+      wait();
+      // The callbacks may serve more screens, which run from the next
+      // iteration on.
+      size_t count = m_served.size();
+      advance();
+      for (size_t i = 0; i < count && m_running; i++) {
+        if (m_served[i]) {
+          m_served[i]->advance();
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Stops run() after the current iteration
+   *
+   * On a served screen, this stops the screen running it.
+   */
+  void stop() {
+    if (Screen *host = m_host) {
+      host->stop();
+      return;
+    }
+    m_running = false;
+    wake();
+  }
+
+  virtual void draw(WINDOW *window) {
     throw CursesException("Screen should never be drawn.");
   }
+
+protected:
+  /**
+   * @brief Stages the windows of the screen, then the popups on top
+   *
+   * @copydetails Element::stage()
+   */
+  bool stage(bool refresh) {
+    if (!damaged()) {
+      return false;
+    }
+    bool staged = Window::stage(refresh);
+    for (ElementId id : m_popups) {
+      static_cast<Popup &>(get(id)).overlay();
+      staged = true;
+    }
+    return staged;
+  }
+
+  void activate() { m_backend->activate(); }
+
+  /**
+   * @copydoc Window::expose()
+   *
+   * The rows are only remembered while compositing, and copied by the next
+   * compose() even if they didn't change.
+   */
+  void expose(const Rect &rect) {
+    if (!m_compositing) {
+      return;
+    }
+    int last = std::min<int>(rect.y + rect.rows, m_exposed.size());
+    for (int row = std::max(rect.y, 0); row < last; row++) {
+      m_exposed[row] = true;
+    }
+  }
+
+private:
+  /**
+   * @brief Constructor owning its backend
+   */
+  explicit Screen(std::unique_ptr<Backend> backend)
+      : Window(0, 0, backend->open()), m_backend(backend.get()),
+        m_ownedBackend(std::move(backend)) {
+    start();
+  }
+
+  /**
+   * @brief Sets up what the constructors share
+   */
+  void start() {
+#ifdef SIMPLECURSES_STATS
+    instrument(&m_instrumentation);
+#endif
+    if (pipe(m_wakeFds) != 0) {
+      m_backend->close();
+      throw CursesException("Could not create the wake-up pipe");
+    }
+    for (int fd : m_wakeFds) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    if (!m_backend->signalsResizes()) {
+      return;
+    }
+    if (pipe(m_resizeFds) != 0) {
+      close(m_wakeFds[0]);
+      close(m_wakeFds[1]);
+      m_backend->close();
+      throw CursesException("Could not create the resize pipe");
+    }
+    for (int fd : m_resizeFds) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    // A target left by a destroyed screen is taken over, or a new one is
+    // pushed.
+    for (ResizeTarget *target = s_resizeTargets; target; target = target->next) {
+      int unused = -1;
+      if (target->fd.compare_exchange_strong(unused, m_resizeFds[1])) {
+        return;
+      }
+    }
+    ResizeTarget *target = new ResizeTarget;
+    target->fd = m_resizeFds[1];
+    target->next = s_resizeTargets;
+    while (!s_resizeTargets.compare_exchange_weak(target->next, target)) {
+    }
+  }
+
+  /**
+   * @brief Stages the damaged windows and flushes them to the terminal
+   */
+  void compose() {
+    prepare();
+    if (!m_compositing) {
+      stage(true);
+      flush();
+      return;
+    }
+    // Every window but the pads shares its memory with the screen, so the
+    // damaged rows of the screen hold the whole frame.
+    bool changed = false;
+    const std::vector<bool> &lines = damagedLines();
+    for (size_t row = 0; row < lines.size(); row++) {
+      if (!lines[row]) {
+        continue;
+      }
+      m_back.capture(handle(), row);
+      bool differs = m_back.diff(m_front, row).first < m_front.cols();
+      if (differs) {
+        m_front.copy(m_back, row);
+      }
+      // Rows uncovered by a pad or a popup differ on the terminal only.
+      differs = differs || (row < m_exposed.size() && m_exposed[row]);
+      changed = changed || differs;
+      wtouchln(handle(), row, 1, differs);
+      if (differs) {
+        if (Instrumentation *instrumentation = this->instrumentation()) {
+          instrumentation->frame.cellsTouched += m_front.cols();
+        }
+      }
+    }
+    m_exposed.assign(m_exposed.size(), false);
+    if (changed) {
+      wnoutrefresh(handle());
+      if (Instrumentation *instrumentation = this->instrumentation()) {
+        instrumentation->frame.refreshes++;
+      }
+    }
+    // The pads are staged on top.
+    if (stage(false) || changed) {
+      flush();
+    }
+  }
+
+  /**
+   * @brief Flushes the virtual screen to the terminal with doupdate()
+   */
+  void flush() {
+#ifdef SIMPLECURSES_STATS
+    unsigned long long before = written();
+    auto start = std::chrono::steady_clock::now();
+    doupdate();
+    std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - start;
+    m_instrumentation.frame.updates++;
+    m_instrumentation.frame.bytesWritten += written() - before;
+    if (m_instrumentation.trace) {
+      m_instrumentation.trace(TraceEvent{"doupdate", NULL, NULL, start, duration});
+    }
+#else
+    doupdate();
+#endif
+    m_backend->presented();
+  }
+
+#ifdef SIMPLECURSES_STATS
+  /**
+   * @brief The number of bytes written by the calling thread so far
+   *
+   * This is read from /proc/thread-self/io where the kernel provides it,
+   * and is 0 otherwise.
+   */
+  unsigned long long written() {
+    if (m_ioFd == -1) {
+      m_ioFd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+      if (m_ioFd == -1) {
+        return 0;
+      }
+    }
+    char buffer[512];
+    ssize_t length = pread(m_ioFd, buffer, sizeof(buffer) - 1, 0);
+    if (length <= 0) {
+      return 0;
+    }
+    buffer[length] = '\0';
+    const char *wchar = std::strstr(buffer, "wchar:");
+    return wchar ? std::strtoull(wchar + 6, NULL, 10) : 0;
+  }
+#endif
+
+  /**
+   * @brief A timer of run()
+   */
+  struct Timer {
+    TimerId id;
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::milliseconds interval;
+    bool repeat;
+    /** @brief The callback, or NULL once cancelled **/
+    std::function<void(Screen &)> callback;
+  };
+
+  /**
+   * @brief A file descriptor watched by run()
+   */
+  struct Watch {
+    int fd;
+    short events;
+    /** @brief The callback, or NULL once unwatched **/
+    std::function<void(Screen &, short)> callback;
+  };
+
+  /**
+   * @brief Makes run() read the keyboard, without blocking
+   *
+   * The keys are read from a window of their own, never drawn to, as
+   * wgetch() refreshes its window if it was touched, which would flush the
+   * changes made since the last frame.
+   */
+  void readKeys() {
+    m_backend->activate();
+    cbreak();
+    noecho();
+    if (!m_keys) {
+      m_keys = newwin(1, 1, 0, 0);
+      if (!m_keys) {
+        throw CursesException("Could not create the window of the keys");
+      }
+      untouchwin(m_keys);
+    }
+    keypad(m_keys, TRUE);
+    nodelay(m_keys, TRUE);
+  }
+
+  /**
+   * @brief Wakes run() up from another thread
+   *
+   * Only the first wake-up since run() last woke writes to the pipe.
+   */
+  void wake() {
+    if (!m_wakePending.exchange(true)) {
+      char byte = 0;
+      ssize_t written = write(m_wakeFds[1], &byte, 1);
+      (void)written;
+    }
+  }
+
+  /**
+   * @brief Drains a non-blocking pipe
+   */
+  static void drain(int fd) {
+    char buffer[64];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+  }
+
+  /**
+   * @brief Waits for the next event, timer or frame of the screens run
+   */
+  void wait() {
+    bool timed = false;
+    auto deadline = m_nextFrame;
+    m_pollFds.clear();
+    schedule(timed, deadline);
+    for (Screen *screen : m_served) {
+      if (screen) {
+        screen->schedule(timed, deadline);
+      }
+    }
+
+    int timeout = -1;
+    if (timed) {
+      auto remaining = deadline - std::chrono::steady_clock::now();
+      // Round up, so as not to wake up just before the deadline.
+      timeout = std::max<long long>(
+          0, std::chrono::ceil<std::chrono::milliseconds>(remaining).count());
+    }
+    if (poll(m_pollFds.data(), m_pollFds.size(), timeout) <= 0) {
+      return;
+    }
+
+    // The callbacks may serve more screens, which weren't polled.
+    size_t count = m_served.size();
+    receive(m_pollFds.data());
+    for (size_t i = 0; i < count; i++) {
+      if (m_served[i]) {
+        m_served[i]->receive(m_pollFds.data());
+      }
+    }
+  }
+
+  /**
+   * @brief Adds what the screen waits for to the wait() of the screen
+   * running it
+   *
+   * @param timed Whether a deadline has been found yet, updated.
+   * @param deadline The earliest deadline found, updated.
+   */
+  void schedule(bool &timed, std::chrono::steady_clock::time_point &deadline) {
+    m_timers.erase(std::remove_if(m_timers.begin(), m_timers.end(),
+                                  [](const Timer &timer) {
+                                    return !timer.callback;
+                                  }),
+                   m_timers.end());
+    m_watches.erase(std::remove_if(m_watches.begin(), m_watches.end(),
+                                   [](const Watch &watch) {
+                                     return !watch.callback;
+                                   }),
+                    m_watches.end());
+    m_served.erase(std::remove(m_served.begin(), m_served.end(), nullptr),
+                   m_served.end());
+
+    if (m_frameCallback || damaged()) {
+      deadline = timed ? std::min(deadline, m_nextFrame) : m_nextFrame;
+      timed = true;
+    }
+    for (const auto &timer : m_timers) {
+      deadline = timed ? std::min(deadline, timer.deadline) : timer.deadline;
+      timed = true;
+    }
+
+    if (m_resizeFds[0] != -1) {
+      installResizeHandler();
+    }
+    std::vector<pollfd> &pollFds = runner().m_pollFds;
+    m_polled = pollFds.size();
+    pollFds.push_back(pollfd{m_wakeFds[0], POLLIN, 0});
+    pollFds.push_back(pollfd{m_resizeFds[0], POLLIN, 0});
+    bool keys = m_keyCallback || m_mouseCallback;
+    pollFds.push_back(pollfd{keys ? m_backend->input() : -1, POLLIN, 0});
+    for (const auto &watch : m_watches) {
+      pollFds.push_back(pollfd{watch.fd, watch.events, 0});
+    }
+    m_watched = m_watches.size();
+  }
+
+  /**
+   * @brief Handles the events polled by wait() for the screen
+   *
+   * @param polled The descriptors polled by wait().
+   */
+  void receive(const pollfd *polled) {
+    const pollfd *fds = polled + m_polled;
+    if (fds[0].revents) {
+      m_wakePending = false;
+      drain(m_wakeFds[0]);
+    }
+    if (fds[1].revents) {
+      drain(m_resizeFds[0]);
+      follow();
+    }
+    if (fds[2].revents) {
+      m_backend->activate();
+      int key;
+      while ((m_keyCallback || m_mouseCallback) &&
+             (key = wgetch(m_keys)) != ERR) {
+        MEVENT event;
+        if (key == KEY_MOUSE && m_mouseCallback) {
+          if (getmouse(&event) == OK) {
+            m_mouseCallback(*this, event, at(event.x, event.y));
+          }
+        } else if (m_keyCallback) {
+          m_keyCallback(*this, key);
+        }
+      }
+    }
+    // The callbacks may add watches, so only go through those polled.
+    for (size_t i = 0; i < m_watched; i++) {
+      if (fds[i + 3].revents && m_watches[i].callback) {
+        std::function<void(Screen &, short)> callback = m_watches[i].callback;
+        callback(*this, fds[i + 3].revents);
+      }
+    }
+  }
+
+  /**
+   * @brief Runs the commands, timers and frame that are due
+   */
+  void advance() {
+    dispatch();
+
+    auto now = std::chrono::steady_clock::now();
+    fireTimers(now);
+    if (now >= m_nextFrame && (m_frameCallback || damaged())) {
+      m_nextFrame = now + m_frameInterval;
+      if (m_frameCallback) {
+        m_frameCallback(*this);
+      }
+      if (damaged()) {
+        commit();
+      }
+    }
+  }
+
+  /** @brief The screen whose run() handles the events of this one **/
+  Screen &runner() {
+    Screen *host = m_host;
+    return host ? *host : *this;
+  }
+
+  /**
+   * @brief Fires the timers that are due
+   */
+  void fireTimers(std::chrono::steady_clock::time_point now) {
+    // The callbacks may add timers, so only go through the existing ones.
+    size_t count = m_timers.size();
+    for (size_t i = 0; i < count; i++) {
+      if (!m_timers[i].callback || m_timers[i].deadline > now) {
+        continue;
+      }
+      std::function<void(Screen &)> callback = m_timers[i].callback;
+      if (m_timers[i].repeat) {
+        m_timers[i].deadline = now + m_timers[i].interval;
+      } else {
+        m_timers[i].callback = NULL;
+      }
+      callback(*this);
+    }
+  }
+
+  /**
+   * @brief Follows a resize of the terminal
+   *
+   * Only the windows that curses had to truncate or move, or that can be
+   * restored to their bounds, are recreated and repainted.
+   */
+  void follow() {
+    int rows, cols;
+    if (m_backend->size(rows, cols)) {
+      resize(rows, cols);
+    }
+  }
+
+  /**
+   * @brief Routes SIGWINCH to the resize pipes of the screens
+   *
+   * This replaces the handler of curses, which only makes wgetch() return
+   * KEY_RESIZE, once a screen following the resizes waits in run().
+   */
+  static void installResizeHandler() {
+    if (s_resizeHandled.exchange(true)) {
+      return;
+    }
+    struct sigaction action = {};
+    action.sa_handler = [](int) {
+      int saved = errno;
+      char byte = 0;
+      for (ResizeTarget *target = s_resizeTargets; target;
+           target = target->next) {
+        int fd = target->fd;
+        if (fd != -1) {
+          ssize_t written = write(fd, &byte, 1);
+          (void)written;
+        }
+      }
+      errno = saved;
+    };
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &action, NULL);
+  }
+
+  /**
+   * @brief The write end of a resize pipe, written to by the SIGWINCH
+   * handler
+   *
+   * The targets are never freed, so that the handler can go through them
+   * at any time; those of the destroyed screens are reused.
+   */
+  struct ResizeTarget {
+    /** @brief The write end, or -1 once its screen is destroyed **/
+    std::atomic<int> fd{-1};
+    ResizeTarget *next = NULL;
+  };
+
+  /** @brief The targets of the screens following the resizes **/
+  static inline std::atomic<ResizeTarget *> s_resizeTargets{NULL};
+
+  /** @brief Whether the SIGWINCH handler is installed **/
+  static inline std::atomic<bool> s_resizeHandled{false};
+
+  /** @brief Where the screen renders **/
+  Backend *m_backend;
+
+  /** @brief The backend, when the screen created it **/
+  std::unique_ptr<Backend> m_ownedBackend;
+
+  /** @brief The color pairs allocated for the screen **/
+  ColorPairs m_colorPairs;
+
+  /** @brief Whether commit() composites **/
+  bool m_compositing = false;
+
+#ifdef SIMPLECURSES_STATS
+  /** @brief The counters and trace callback shared with the windows **/
+  Instrumentation m_instrumentation;
+
+  /** @brief What the last commit() cost **/
+  FrameStats m_lastFrame;
+
+  /** @brief What all the commits so far cost **/
+  FrameStats m_totalStats;
+
+  /** @brief The I/O accounting of the render thread, once opened **/
+  int m_ioFd = -1;
+#endif
+
+  /** @brief The last committed frame **/
+  CellBuffer m_front;
+
+  /** @brief The rows to commit even if they didn't change **/
+  std::vector<bool> m_exposed;
+
+  /** @brief The curses windows of the closed popups **/
+  WindowPool m_popupWindows;
+
+  /** @brief The open popups, from the bottom up **/
+  std::vector<ElementId> m_popups;
+
+  /** @brief The frame being committed **/
+  CellBuffer m_back;
+
+  /** @brief The minimum time between two frames of run() **/
+  std::chrono::nanoseconds m_frameInterval = std::chrono::milliseconds(16);
+
+  /** @brief The callback run at the start of every frame **/
+  std::function<void(Screen &)> m_frameCallback;
+
+  /** @brief Whether run() should go on **/
+  std::atomic<bool> m_running{false};
+
+  /** @brief The commands posted by other threads **/
+  CommandQueue<std::function<void(Screen &)>> m_commands;
+
+  /** @brief The wake-up pipe of run() **/
+  int m_wakeFds[2];
+
+  /** @brief Whether the wake-up pipe has been written to **/
+  std::atomic<bool> m_wakePending{false};
+
+  /** @brief The resize pipe of run(), if the backend signals resizes **/
+  int m_resizeFds[2] = {-1, -1};
+
+  /** @brief The time of the next frame of run() **/
+  std::chrono::steady_clock::time_point m_nextFrame;
+
+  /** @brief The screen running this one, with serve(), read by stop() **/
+  std::atomic<Screen *> m_host{NULL};
+
+  /** @brief The screens run by this one, NULL once unserved **/
+  std::vector<Screen *> m_served;
+
+  /** @brief The position of the descriptors of the screen in wait() **/
+  size_t m_polled = 0;
+
+  /** @brief The number of watches polled by wait() **/
+  size_t m_watched = 0;
+
+  /** @brief The window the keys are read from, once they are **/
+  WINDOW *m_keys = NULL;
+
+  /** @brief The callback run for every key **/
+  std::function<void(Screen &, int)> m_keyCallback;
+
+  /** @brief The callback run for every mouse event **/
+  std::function<void(Screen &, const MEVENT &, Element *)> m_mouseCallback;
+
+  /** @brief The callback run after the terminal is resized **/
+  std::function<void(Screen &)> m_resizeCallback;
+
+  /** @brief The timers **/
+  std::vector<Timer> m_timers;
+
+  /** @brief The handle of the next timer **/
+  TimerId m_nextTimerId = 0;
+
+  /** @brief The watched file descriptors **/
+  std::vector<Watch> m_watches;
+
+  /** @brief The file descriptors polled by run() **/
+  std::vector<pollfd> m_pollFds;
 };
 
 } // namespace SimpleCurses
@@ -0,0 +1,691 @@
+/**
+ * @file tests.cpp
+ * @brief Checks what screens render, through a MemoryBackend
+ *
+ * The checks of wide characters need ncursesw:
+ *
+ * @code
+ * make check
+ * make -B check CXXFLAGS="-std=c++17 -DSIMPLECURSES_WIDECHAR" LDLIBS=-lncursesw
+ * @endcode
+ */
+#include "simplecurses++.hh"
+
+#include <clocale>
+#include <cstdlib>
+
+#include <sys/socket.h>
+
+using namespace SimpleCurses;
+
+static int failures = 0;
+
+/**
+ * @brief Reports a failed check without stopping the others
+ */
+static void check(bool condition, const char *what, int line) {
+  if (!condition) {
+    fprintf(stderr, "tests.cpp:%d: %s\n", line, what);
+    failures++;
+  }
+}
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+/**
+ * @brief A Text changes in place, whether it grows or shrinks
+ */
+static void textChangesInPlace() {
+  MemoryBackend backend(1, 20);
+  Screen screen(backend);
+  Text &text = screen.emplace<Text>("text", 2, 0, "hello world");
+  screen.commit();
+
+  text.setText("help world!");
+  screen.commit();
+  CHECK(backend.cells().text(0) == "  help world!       ");
+
+  text.setText("hi");
+  screen.commit();
+  CHECK(backend.cells().text(0) == "  hi                ");
+
+  text.format("%d items", 12);
+  screen.commit();
+  CHECK(backend.cells().text(0) == "  12 items          ");
+  CHECK(text.text() == "12 items");
+  CHECK(text.cols() == 8);
+
+  bool thrown = false;
+  try {
+    text.setText("far too long to fit here");
+  } catch (const CursesException &) {
+    thrown = true;
+  }
+  CHECK(thrown);
+  CHECK(text.text() == "12 items");
+}
+
+/**
+ * @brief The rows of a ListView are its indices
+ */
+class Numbers : public ListSource {
+public:
+  explicit Numbers(size_t count) : m_count(count) {}
+
+  size_t rowCount() const { return m_count; }
+
+  void renderRow(size_t index, WINDOW *window) {
+    wprintw(window, "%zu", index);
+  }
+
+private:
+  size_t m_count;
+};
+
+/**
+ * @brief A ListView scrolls within its rows and draws them from the source
+ */
+static void listScrolls() {
+  MemoryBackend backend(3, 10);
+  Screen screen(backend);
+  Numbers numbers(10);
+  ListView &list = screen.emplace<ListView>("list", 0, 0, 3, 4, numbers);
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 4, "0   ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 4, "2   ") == 0);
+
+  list.scrollTo(2);
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 4, "2   ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 4, "4   ") == 0);
+
+  list.scrollBy(1);
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 4, "3   ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 4, "5   ") == 0);
+
+  list.scrollBy(-10);
+  screen.commit();
+  CHECK(list.top() == 0);
+  CHECK(backend.cells().text(1).compare(0, 4, "1   ") == 0);
+
+  list.scrollTo(100);
+  screen.commit();
+  CHECK(list.top() == 7);
+  CHECK(backend.cells().text(0).compare(0, 4, "7   ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 4, "9   ") == 0);
+}
+
+/**
+ * @brief A LogView keeps its newest lines, shown from the bottom up
+ */
+static void logScrolls() {
+  MemoryBackend backend(3, 10);
+  Screen screen(backend);
+  LogView &log = screen.emplace<LogView>("log", 0, 0, 3, 6, 4);
+  log.append("one");
+  log.append("two");
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 6, "      ") == 0);
+  CHECK(backend.cells().text(1).compare(0, 6, "one   ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 6, "two   ") == 0);
+
+  log.append("three");
+  log.append("four");
+  log.append("five and more");
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 6, "three ") == 0);
+  CHECK(backend.cells().text(1).compare(0, 6, "four  ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 6, "five a") == 0);
+  CHECK(backend.cells().text(2).compare(6, 4, "    ") == 0);
+  CHECK(log.size() == 4);
+  CHECK(log.line(0) == "two");
+  CHECK(log.line(3) == "five a");
+
+  log.clear();
+  screen.commit();
+  CHECK(log.size() == 0);
+  CHECK(backend.cells().text(2).compare(0, 6, "      ") == 0);
+}
+
+/**
+ * @brief A box layout shares the space by weight, and follows resizes
+ */
+static void layoutSharesSpace() {
+  MemoryBackend backend(10, 40);
+  Screen screen(backend);
+  screen.emplace<Window>("sidebar", 0, 0, 1, 1, false);
+  screen.emplace<Window>("log", 0, 0, 1, 1, false);
+  Window &status = screen.emplace<Window>("status", 0, 0, 3, 10, false);
+  status.emplace<Text>("text", 0, 0, "ready");
+  BoxLayout &root = screen.setLayout(BoxLayout::Horizontal, 1);
+  root.add(screen.find("sidebar"), Constraints{0, 10});
+  BoxLayout &main = root.addBox(BoxLayout::Vertical);
+  main.add(screen.find("log"), Constraints{2});
+  main.add(screen.find("status"), Constraints{0, 3});
+  screen.commit();
+
+  auto bounds = [&](const char *name) {
+    return screen.get(screen.find(name)).bounds();
+  };
+  CHECK(bounds("sidebar") == (Rect{0, 0, 10, 10}));
+  CHECK(bounds("log") == (Rect{11, 0, 7, 29}));
+  CHECK(bounds("status") == (Rect{11, 7, 3, 29}));
+  CHECK(backend.cells().text(7).compare(11, 5, "ready") == 0);
+
+  screen.resize(12, 50);
+  screen.commit();
+  CHECK(bounds("sidebar") == (Rect{0, 0, 12, 10}));
+  CHECK(bounds("log") == (Rect{11, 0, 9, 39}));
+  CHECK(bounds("status") == (Rect{11, 9, 3, 39}));
+  CHECK(backend.cells().text(9).compare(11, 5, "ready") == 0);
+}
+
+/**
+ * @brief Overlapping windows are drawn in their stacking order as they are
+ * raised, lowered, moved and removed
+ *
+ * @param compositing Whether the screen composites.
+ */
+static void windowsStack(bool compositing) {
+  MemoryBackend backend(2, 20);
+  Screen screen(backend);
+  screen.setCompositing(compositing);
+  const char *names[] = {"a", "b", "c"};
+  const int xs[] = {0, 4, 2};
+  for (int i = 0; i < 3; i++) {
+    Window &window = screen.emplace<Window>(names[i], xs[i], 0, 1, 8, false);
+    window.emplace<Text>("text", 0, 0, std::string(8, 'A' + i));
+  }
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 18, "AACCCCCCCCBB      ") == 0);
+
+  screen.raise(screen.find("a"));
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 18, "AAAAAAAACCBB      ") == 0);
+
+  screen.lower(screen.find("c"));
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 18, "AAAAAAAABBBB      ") == 0);
+
+  static_cast<Window &>(screen.get(screen.find("b")))
+      .setBounds(Rect{10, 0, 1, 8});
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 18, "AAAAAAAACCBBBBBBBB") == 0);
+  Element *hit = screen.at(9, 0);
+  CHECK(hit && hit->parent() == &screen.get(screen.find("c")));
+
+  screen.remove("a");
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 18, "  CCCCCCCCBBBBBBBB") == 0);
+}
+
+/**
+ * @brief Meters clamp their values and fill their cells by eighths
+ */
+static void metersFill() {
+  MemoryBackend backend(4, 20);
+  Screen screen(backend);
+  ProgressBar &bar = screen.emplace<ProgressBar>("bar", 0, 0, 4);
+  Gauge &gauge = screen.emplace<Gauge>("gauge", 10, 0, 4, 1, 0, 100);
+  Sparkline &spark = screen.emplace<Sparkline>("spark", 0, 2, 4, 0, 8);
+
+  bar.setValue(0.5);
+  gauge.setValue(50);
+  spark.push(8);
+  spark.push(4);
+  screen.commit();
+  CHECK(spark.sample(0) == 4);
+  CHECK(spark.sample(1) == 8);
+#ifndef SIMPLECURSES_WIDECHAR
+  CHECK(backend.cells().text(0).compare(0, 4, "##  ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 4, "  #-") == 0);
+  CHECK(backend.cells().text(1)[10] == ' ');
+  CHECK(backend.cells().text(2)[10] == '#');
+  CHECK(backend.cells().text(3)[10] == '#');
+#endif
+
+  bar.setValue(0.53);
+  gauge.setValue(-5);
+  screen.commit();
+  CHECK(gauge.value() == 0);
+#ifndef SIMPLECURSES_WIDECHAR
+  CHECK(backend.cells().text(0).compare(0, 4, "##. ") == 0);
+  CHECK(backend.cells().text(3)[10] == ' ');
+#endif
+
+  bar.setValue(2);
+  screen.commit();
+  CHECK(bar.value() == 1);
+#ifndef SIMPLECURSES_WIDECHAR
+  CHECK(backend.cells().text(0).compare(0, 4, "####") == 0);
+#endif
+}
+
+/**
+ * @brief A TextView reads the caller's view again once its generation moves
+ */
+static void textViewFollowsItsText() {
+  MemoryBackend backend(2, 20);
+  Screen screen(backend);
+  char buffer[] = "100.25 99.75";
+  std::string_view price(buffer, 6);
+  std::atomic<uint64_t> generation{0};
+  TextView &view = screen.emplace<TextView>("price", 0, 0, 8, price,
+                                            generation);
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 8, "100.25  ") == 0);
+
+  price = std::string_view(buffer + 7, 5);
+  CHECK(!view.poll());
+  generation.fetch_add(1, std::memory_order_release);
+  CHECK(view.poll());
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 8, "99.75   ") == 0);
+}
+
+/**
+ * @brief The cells a pad leaves behind are cleared while compositing
+ */
+static void padLeavesNoTrace() {
+  MemoryBackend backend(6, 20);
+  Screen screen(backend);
+  screen.setCompositing(true);
+  PadWindow &pad = screen.emplace<PadWindow>("pad", 2, 1, 2, 8, 4, 8);
+  for (int row = 0; row < 4; row++) {
+    pad.emplace<Text>(std::to_string(row), 0, row,
+                      "line " + std::to_string(row));
+  }
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(0, 10, "  line 0  ") == 0);
+
+  pad.scrollTo(2, 0);
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(0, 10, "  line 2  ") == 0);
+  CHECK(backend.cells().text(2).compare(0, 10, "  line 3  ") == 0);
+
+  pad.setBounds(Rect{6, 3, 2, 8});
+  screen.commit();
+  CHECK(backend.cells().text(1) == std::string(20, ' '));
+  CHECK(backend.cells().text(3).compare(0, 12, "      line 2") == 0);
+  CHECK(backend.cells().text(4).compare(0, 12, "      line 3") == 0);
+
+  screen.remove("pad");
+  screen.commit();
+  CHECK(backend.cells().text(3) == std::string(20, ' '));
+  CHECK(backend.cells().text(4) == std::string(20, ' '));
+}
+
+/**
+ * @brief A pad laid out in a box keeps the size of its content
+ */
+static void padInLayoutScrolls() {
+  MemoryBackend backend(6, 20);
+  Screen screen(backend);
+  Window &root = screen.emplace<Window>("root", 0, 0, 6, 20, false);
+  PadWindow &pad = root.emplace<PadWindow>("pad", 0, 0, 1, 1, 10, 12);
+  for (int row = 0; row < 10; row++) {
+    pad.emplace<Text>(std::to_string(row), 0, row,
+                      "line " + std::to_string(row));
+  }
+  root.setLayout(BoxLayout::Vertical).add(root.find("pad"));
+  screen.commit();
+  CHECK(pad.rows() == 6 && pad.cols() == 20);
+  pad.scrollTo(3, 0);
+  screen.commit();
+  CHECK(pad.top() == 3);
+  CHECK(backend.cells().text(0).compare(0, 8, "line 3  ") == 0);
+  CHECK(backend.cells().text(5).compare(0, 8, "line 8  ") == 0);
+}
+
+/**
+ * @brief Shortening a text repaints the window stacked over its tail
+ */
+static void shorterTextKeepsWindowAbove() {
+  MemoryBackend backend(4, 20);
+  Screen screen(backend);
+  Text &text = screen.emplace<Text>("text", 0, 1, "a rather long text");
+  Window &window = screen.emplace<Window>("window", 8, 0, 3, 6, false);
+  window.emplace<Text>("label", 0, 1, "WINDOW");
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(0, 18, "a ratherWINDOWtext") == 0);
+
+  text.setText("short");
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(0, 18, "short   WINDOW    ") == 0);
+}
+
+/**
+ * @brief A window moved under another one stays hidden
+ */
+static void movedWindowStaysBeneath() {
+  MemoryBackend backend(6, 20);
+  Screen screen(backend);
+  Window &below = screen.emplace<Window>("below", 0, 0, 2, 4, false);
+  below.emplace<Text>("label", 0, 1, "BBBB");
+  Window &above = screen.emplace<Window>("above", 10, 0, 4, 8, false);
+  above.emplace<Text>("label", 0, 1, "AAAAAAAA");
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(0, 18, "BBBB      AAAAAAAA") == 0);
+
+  below.setBounds(Rect{12, 1, 2, 4});
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(0, 18, "          AAAAAAAA") == 0);
+  CHECK(backend.cells().text(2).compare(0, 18, "                  ") == 0);
+}
+
+/**
+ * @brief Every combination of colors gets a pair, recycled once they run
+ * out
+ */
+static void colorPairsStayValid() {
+  MemoryBackend backend(2, 10);
+  Screen screen(backend);
+  ColorPairs &pairs = *screen.colorPairs();
+  int invalid = 0;
+  for (int fg = -1; fg < 256; fg++) {
+    for (int bg = -1; bg < 256; bg++) {
+      if (fg == -1 && bg == -1) {
+        continue;
+      }
+      short pair = pairs.get(fg, bg);
+      short pairFg, pairBg;
+      if (pair <= 0 || pair_content(pair, &pairFg, &pairBg) == ERR ||
+          pairFg != fg || pairBg != bg) {
+        invalid++;
+      }
+    }
+  }
+  CHECK(invalid == 0);
+}
+
+/**
+ * @brief The static layout documented in the header compiles and draws
+ */
+static void staticLayoutAsDocumented() {
+  typedef Static::Layout<
+      5, 40,
+      Static::Box<0, 0, 5, 40, true,
+                  Static::Column<1, 0, Static::Label<0, 0, 20>,
+                                 Static::Row<0, 1, Static::Label<0, 0, 10>,
+                                             Static::Label<2, 0, 10>>>>>
+      Dashboard;
+
+  MemoryBackend backend(6, 40);
+  Screen screen(backend);
+  Dashboard &dashboard = screen.emplace<Dashboard>("dashboard", 0, 0);
+  dashboard.get<0>().get<0>().get<0>().set("Status");
+  dashboard.get<0>().get<0>().get<1>().get<1>().set("ok");
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(1, 8, " Status ") == 0);
+  CHECK(backend.cells().text(3).compare(1, 16, "             ok ") == 0);
+}
+
+/**
+ * @brief A screen keeps drawing after another one is closed
+ */
+static void screenOutlivesAnother() {
+  MemoryBackend backend(2, 10);
+  Screen screen(backend);
+  screen.emplace<Text>("first", 0, 0, "first");
+  screen.commit();
+  {
+    MemoryBackend other(2, 10);
+    Screen closed(other);
+    closed.emplace<Text>("other", 0, 0, "other");
+    closed.commit();
+    CHECK(other.cells().text(0).compare(0, 5, "other") == 0);
+  }
+  screen.emplace<Text>("second", 0, 1, "second");
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 5, "first") == 0);
+  CHECK(backend.cells().text(1).compare(0, 6, "second") == 0);
+}
+
+static_assert(!std::is_constructible<NumberField<int>, int, int, int,
+                                     std::atomic<int>>::value,
+              "A number field can't keep a temporary variable");
+
+/**
+ * @brief A NumberField shows the caller's variable once polled
+ */
+static void numberFieldFollowsItsVariable() {
+  MemoryBackend backend(2, 10);
+  Screen screen(backend);
+  std::atomic<int> count{42};
+  auto &field = screen.emplace<NumberField<int>>("count", 0, 0, 5, count);
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 5, "   42") == 0);
+
+  count = 1234;
+  CHECK(field.poll());
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 5, " 1234") == 0);
+}
+
+/**
+ * @brief The peer of a closed terminal sees it hang up while another one
+ * stays open
+ */
+static void closedTerminalHangsUp() {
+  MemoryBackend backend(2, 10);
+  Screen screen(backend);
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  {
+    TerminalBackend session(fds[0], dup(fds[0]), "xterm");
+    Screen remote(session);
+    remote.emplace<Text>("text", 0, 0, "remote");
+    remote.commit();
+  }
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  char buffer[4096];
+  ssize_t length;
+  while ((length = read(fds[1], buffer, sizeof(buffer))) > 0) {
+  }
+  CHECK(length == 0);
+  close(fds[1]);
+
+  screen.emplace<Text>("text", 0, 0, "local");
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 5, "local") == 0);
+}
+
+/**
+ * @brief Reading a key draws nothing before the next frame
+ */
+static void keysDontRefresh() {
+  int fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  char buffer[4096];
+  {
+    TerminalBackend session(fds[0], dup(fds[0]), "xterm");
+    Screen screen(session);
+    Text &text = screen.emplace<Text>("text", 0, 0, "before");
+    screen.commit();
+    while (read(fds[1], buffer, sizeof(buffer)) > 0) {
+    }
+    // Only the sequence turning the keypad on may be written.
+    std::string drawn;
+    screen.onKey([&](Screen &screen, int) {
+      ssize_t length;
+      while ((length = read(fds[1], buffer, sizeof(buffer))) > 0) {
+        drawn.append(buffer, length);
+      }
+      screen.stop();
+    });
+    text.setText("after");
+    CHECK(write(fds[1], "q", 1) == 1);
+    screen.run();
+    CHECK(drawn.find("after") == std::string::npos);
+  }
+  close(fds[1]);
+}
+
+/**
+ * @brief Elements stored by value are prepared and moved like the others
+ */
+static void typedWindowRunsHooks() {
+  MemoryBackend backend(4, 20);
+  Screen screen(backend);
+  auto &logs = screen.emplace<TypedWindow<LogView>>("logs", 0, 0, 2, 10,
+                                                    false);
+  LogView &log = logs.add<LogView>(0, 0, 2, 10);
+  screen.commit();
+  log.append("first");
+  screen.commit();
+  log.append("second");
+  log.append("third");
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 10, "second    ") == 0);
+  CHECK(backend.cells().text(1).compare(0, 10, "third     ") == 0);
+
+  Numbers numbers(10);
+  auto &lists = screen.emplace<TypedWindow<ListView>>("lists", 10, 0, 2, 10,
+                                                      false);
+  lists.add<ListView>(0, 0, 2, 5, numbers);
+  lists.add(std::make_unique<Text>(6, 0, "text"));
+  screen.commit();
+  lists.setBounds(Rect{10, 2, 2, 10});
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(10, 10, "          ") == 0);
+  CHECK(backend.cells().text(2).compare(10, 10, "0     text") == 0);
+  CHECK(backend.cells().text(3).compare(10, 10, "1         ") == 0);
+}
+
+/**
+ * @brief A stamp on a screen turns into texts that can change
+ */
+static void screenUnsharesStamp() {
+  MemoryBackend backend(2, 20);
+  Screen screen(backend);
+  auto chrome = std::make_shared<Template>();
+  chrome->add("title", 0, 0, "Orders").add("help", 0, 1, "q: quit");
+  screen.emplace<Stamp>("chrome", 0, 0, chrome);
+  screen.commit();
+  CHECK(backend.cells().text(1).compare(0, 7, "q: quit") == 0);
+
+  Window &window = screen.unshare("chrome");
+  static_cast<Text &>(window.get(window.find("help"))).setText("h: help");
+  screen.commit();
+  CHECK(backend.cells().text(0).compare(0, 6, "Orders") == 0);
+  CHECK(backend.cells().text(1).compare(0, 7, "h: help") == 0);
+}
+
+/**
+ * @brief A memory backend counting the times its size is asked for,
+ * which run() does on every resize it's signalled
+ */
+class ResizeCounter : public MemoryBackend {
+public:
+  ResizeCounter(int rows, int cols, bool signalled)
+      : MemoryBackend(rows, cols), m_signalled(signalled) {}
+
+  bool size(int &, int &) {
+    asked++;
+    return false;
+  }
+
+  bool signalsResizes() const { return m_signalled; }
+
+  int asked = 0;
+
+private:
+  bool m_signalled;
+};
+
+/**
+ * @brief One run() serves another screen, resizes included
+ */
+static void servedScreenRuns() {
+  ResizeCounter backend(2, 10, false), other(2, 10, true);
+  Screen screen(backend);
+  Screen served(other);
+  screen.serve(served);
+  Text &text = served.emplace<Text>("text", 0, 0, "before");
+  served.post([&](Screen &) {
+    text.setText("after");
+    raise(SIGWINCH);
+  });
+  served.addTimer(std::chrono::milliseconds(50),
+                  [](Screen &screen) { screen.stop(); });
+  screen.run();
+  CHECK(other.cells().text(0).compare(0, 6, "after ") == 0);
+  CHECK(backend.asked == 0);
+  CHECK(other.asked == 1);
+}
+
+/**
+ * @brief Any number of screens can be open at once
+ */
+static void manyScreensOpen() {
+  std::vector<std::unique_ptr<ResizeCounter>> backends;
+  std::vector<std::unique_ptr<Screen>> screens;
+  for (int i = 0; i < 100; i++) {
+    backends.push_back(std::make_unique<ResizeCounter>(1, 10, i % 2 == 0));
+    screens.push_back(std::make_unique<Screen>(*backends.back()));
+  }
+  screens.front()->emplace<Text>("text", 0, 0, "first");
+  screens.front()->commit();
+  CHECK(backends.front()->cells().text(0).compare(0, 5, "first") == 0);
+  screens.clear();
+}
+
+#ifdef SIMPLECURSES_WIDECHAR
+/**
+ * @brief The compositor tells apart wide characters sharing a low byte
+ */
+static void compositorComparesWideCharacters() {
+  MemoryBackend backend(2, 10);
+  Screen screen(backend);
+  screen.setCompositing(true);
+  Text &text = screen.emplace<Text>("text", 0, 0, "\u4e2d");
+  screen.commit();
+  CHECK(backend.cells().character(0, 0) == 0x4e2d);
+
+  text.setText("\u5b2d");
+  screen.commit();
+  CHECK(backend.cells().character(0, 0) == 0x5b2d);
+}
+#endif
+
+int main() {
+  setlocale(LC_ALL, "C.UTF-8");
+  setenv("TERM", "xterm-256color", 0);
+  try {
+    textChangesInPlace();
+    listScrolls();
+    logScrolls();
+    layoutSharesSpace();
+    windowsStack(false);
+    windowsStack(true);
+    metersFill();
+    textViewFollowsItsText();
+    padLeavesNoTrace();
+    padInLayoutScrolls();
+    shorterTextKeepsWindowAbove();
+    movedWindowStaysBeneath();
+    colorPairsStayValid();
+    staticLayoutAsDocumented();
+    screenOutlivesAnother();
+    numberFieldFollowsItsVariable();
+    closedTerminalHangsUp();
+    keysDontRefresh();
+    screenUnsharesStamp();
+    typedWindowRunsHooks();
+    servedScreenRuns();
+    manyScreensOpen();
+#ifdef SIMPLECURSES_WIDECHAR
+    compositorComparesWideCharacters();
+#endif
+  } catch (const CursesException &ex) {
+    fprintf(stderr, "%s\n", ex.what());
+    return 1;
+  }
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}